@@ -0,0 +1,192 @@
+/* By: Bagus Maulana */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "bootsect.h"
+#include "bpb.h"
+#include "direntry.h"
+#include "fat.h"
+#include "dos.h"
+#include "dos_scandisk.h"
+#include "batch.h"
+#include "triage.h"
+
+int hash_image64(char *imagename, uint64_t *hash, uint64_t *size) {
+    // A fast 64 bit hash of the whole image (not a cryptographic one: it only has to tell
+    // different images apart, not stand up to someone making collisions on purpose)
+    struct stat st;
+    uint8_t *map;
+    uint64_t h = 0x9e3779b97f4a7c15ULL, word;
+    off_t i;
+    int fd = open(imagename, O_RDONLY);
+
+    if(fd < 0 || fstat(fd, &st) < 0) {
+        if(fd >= 0)
+            close(fd);
+        return -1;
+    }
+    *size = st.st_size;
+    if(st.st_size) {
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if(map == MAP_FAILED) {
+            close(fd);
+            return -1;
+        }
+        for(i = 0; i + 8 <= st.st_size; i += 8) {
+            memcpy(&word, map + i, 8);
+            h = (h ^ word) * 0xff51afd7ed558ccdULL;
+            h ^= h >> 32;
+        }
+        for(; i < st.st_size; i++)
+            h = (h ^ map[i]) * 0x100000001b3ULL;
+        munmap(map, st.st_size);
+    }
+    h ^= st.st_size;
+    h = (h ^ (h >> 33)) * 0xc4ceb9fe1a85ec53ULL;
+    *hash = h ^ (h >> 33);
+    close(fd);
+    return 0;
+}
+
+int copy_to_stdout(char *path) {
+    char buf[4096];
+    ssize_t n;
+    int fd = open(path, O_RDONLY);
+    if(fd < 0)
+        return -1;
+    fflush(stdout);
+    while((n = read(fd, buf, sizeof(buf))) > 0) {
+        if(write(STDOUT_FILENO, buf, n) != n)
+            break;
+    }
+    close(fd);
+    return 0;
+}
+
+struct cache_entry {
+    char name[64];
+    time_t mtime;
+    off_t size;
+};
+
+int older_entry(const void *a, const void *b) {
+    const struct cache_entry *x = a, *y = b;
+    return x->mtime < y->mtime ? -1 : x->mtime > y->mtime;
+}
+
+void evict(struct result_cache *cache) {
+    // Removes the least recently used results until the cache fits in its limit. A hit
+    // touches its file, so the modification times give the LRU order.
+    struct cache_entry *entries = NULL;
+    struct dirent *d;
+    struct stat st;
+    char path[MAXPATHLEN + 1];
+    long long total = 0;
+    int n = 0, i;
+    DIR *dir = opendir(cache->dir);
+
+    if(!dir)
+        return;
+    while((d = readdir(dir))) {
+        if(strlen(d->d_name) != 33 || d->d_name[16] != '-')
+            continue;  // not a result (results are named <hash>-<size in hex>, 16 + 1 + 16)
+        if(snprintf(path, sizeof(path), "%s/%s", cache->dir, d->d_name) >= sizeof(path) || stat(path, &st) < 0)
+            continue;
+        if(n == 0 || (n & (n - 1)) == 0)
+            entries = realloc(entries, (n ? 2 * n : 1) * sizeof(struct cache_entry));
+        strcpy(entries[n].name, d->d_name);
+        entries[n].mtime = st.st_mtime;
+        entries[n].size = st.st_size;
+        total += st.st_size;
+        n++;
+    }
+    closedir(dir);
+
+    qsort(entries, n, sizeof(struct cache_entry), older_entry);
+    for(i = 0; i < n && total > cache->limit; i++) {
+        snprintf(path, sizeof(path), "%s/%s", cache->dir, entries[i].name);
+        if(unlink(path) == 0) {
+            total -= entries[i].size;
+            cache->evicted++;
+        }
+    }
+    free(entries);
+}
+
+char *run_batch(char **images, int nimages, struct result_cache *cache) {
+    // Checks each image in a child process that works on a private copy (so results
+    // depend only on the image's contents), and prints its report. Reports are cached
+    // under a hash of the image, so an image seen before isn't scanned again. Returns
+    // the image to scan in a child process; in the parent it exits when all are done.
+    char path[MAXPATHLEN + 1], tmppath[MAXPATHLEN + 1], why[128];
+    uint64_t hash, size;
+    int i, fd, status, failed = 0;
+    pid_t pid;
+
+    if(mkdir(cache->dir, 0755) < 0 && errno != EEXIST) {
+        fprintf(stderr, "Cannot create %s: %s\n", cache->dir, strerror(errno));
+        exit(1);
+    }
+    for(i = 0; i < nimages; i++) {
+        // junk is skipped before it is even mapped
+        if(triage_image(images[i], why, sizeof(why)) == TRIAGE_JUNK) {
+            printf("Image: %s\nTriage: junk (%s)\n", images[i], why);
+            cache->junk++;
+            continue;
+        }
+        if(hash_image64(images[i], &hash, &size) < 0) {
+            fprintf(stderr, "Cannot read %s: %s\n", images[i], strerror(errno));
+            failed++;
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%016llx-%016llx", cache->dir, (unsigned long long) hash, (unsigned long long) size);
+        if(access(path, R_OK) == 0) {
+            cache->hits++;
+            utimensat(AT_FDCWD, path, NULL, 0);  // now the most recently used
+            printf("Image: %s (cached)\n", images[i]);
+            copy_to_stdout(path);
+            continue;
+        }
+
+        cache->misses++;
+        printf("Image: %s\n", images[i]);
+        fflush(stdout);
+        snprintf(tmppath, sizeof(tmppath), "%s/tmp.%i", cache->dir, (int) getpid());
+        fd = open(tmppath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(fd < 0) {
+            fprintf(stderr, "Cannot create %s: %s\n", tmppath, strerror(errno));
+            exit(1);
+        }
+        pid = fork();
+        if(pid == 0) {
+            dup2(fd, STDOUT_FILENO);
+            close(fd);
+            return images[i];
+        }
+        close(fd);
+        if(pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            // print what there is, but don't cache a failed scan
+            copy_to_stdout(tmppath);
+            unlink(tmppath);
+            failed++;
+            continue;
+        }
+        copy_to_stdout(tmppath);
+        if(rename(tmppath, path) < 0)
+            unlink(tmppath);
+        evict(cache);
+    }
+    evict(cache);  // in case the limit is lower than last time
+    printf("Cache: %i hits, %i misses, %i evicted (%i junk images skipped)\n", cache->hits, cache->misses, cache->evicted, cache->junk);
+    exit(failed ? 1 : 0);
+}
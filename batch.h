@@ -0,0 +1,11 @@
+/* By: Bagus Maulana */
+
+/* prototypes for functions in batch.c */
+
+struct result_cache {
+    char *dir;
+    long long limit;        // bytes the cached results may take up
+    int hits, misses, evicted, junk;
+};
+
+char *run_batch(char **images, int nimages, struct result_cache *cache);
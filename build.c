@@ -0,0 +1,526 @@
+/* By: Bagus Maulana */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "bootsect.h"
+#include "bpb.h"
+#include "direntry.h"
+#include "fat.h"
+#include "dos.h"
+#include "dos_scandisk.h"
+#include "lfn.h"
+#include "build.h"
+
+#define BUILD_BUFFER (1 << 20)  // bytes gathered before each write
+#define FAT12_MAX_CLUSTERS 4084
+#define BUILD_MEDIA 0xf0
+
+// a host file or directory, and where the plan puts it in the image
+struct build_node {
+    char *host;                 // path on the host
+    char *name;                 // name on the host (UTF-8), for the long name
+    uint8_t short_name[11];
+    int slots;                  // long name slots before its entry
+    int is_dir;
+    uint32_t size;
+    time_t mtime;
+    uint16_t start;             // first cluster, or 0 if it has none
+    uint32_t clusters;
+    int entries;                // directory entries a directory needs
+    struct build_node **children;
+    int nchildren;
+};
+
+// the image as it is written, front to back
+struct build_out {
+    int fd;
+    uint8_t *buf;
+    size_t len;
+    int failed;
+};
+
+// the layout the plan works out before anything is written
+struct build_plan {
+    struct build_geometry *g;
+    uint32_t cluster_size, fat_secs, root_secs, nclust, next;
+    uint8_t *fat;
+    int skipped;
+};
+
+int parse_geometry(char *s, struct build_geometry *g) {
+    // SECTORS[,SECTOR_SIZE[,CLUSTER_SECTORS[,ROOT_ENTRIES]]]; the rest keep their defaults
+    return sscanf(s, "%u,%u,%u,%u", &g->sectors, &g->bytes_per_sector, &g->cluster_sectors, &g->root_entries) >= 1;
+}
+
+void out_flush(struct build_out *out) {
+    size_t done = 0;
+    ssize_t n;
+    while(done < out->len && !out->failed) {
+        n = write(out->fd, out->buf + done, out->len - done);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            out->failed = 1;
+        else
+            done += n;
+    }
+    out->len = 0;
+}
+
+void out_write(struct build_out *out, const void *data, size_t len) {
+    size_t n;
+    while(len) {
+        if(out->len == BUILD_BUFFER)
+            out_flush(out);
+        n = BUILD_BUFFER - out->len < len ? BUILD_BUFFER - out->len : len;
+        if(data) {
+            memcpy(out->buf + out->len, data, n);
+            data = (const uint8_t *) data + n;
+        } else {
+            memset(out->buf + out->len, 0, n);  // NULL data writes zeros
+        }
+        out->len += n;
+        len -= n;
+    }
+}
+
+void out_file(struct build_out *out, struct build_node *node, uint32_t padded) {
+    // Reads a host file straight into the buffer, then pads it to whole clusters
+    uint32_t done = 0;
+    ssize_t n;
+    int fd = open(node->host, O_RDONLY);
+
+    if(fd < 0)
+        fprintf(stderr, "Cannot read %s: %s\n", node->host, strerror(errno));
+    while(fd >= 0 && done < node->size) {
+        if(out->len == BUILD_BUFFER)
+            out_flush(out);
+        n = read(fd, out->buf + out->len, BUILD_BUFFER - out->len < node->size - done ? BUILD_BUFFER - out->len : node->size - done);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0) {
+            fprintf(stderr, "%s got shorter while it was copied\n", node->host);
+            break;
+        }
+        out->len += n;
+        done += n;
+    }
+    if(fd >= 0)
+        close(fd);
+    out_write(out, NULL, padded - done);
+}
+
+int cmp_node(const void *a, const void *b) {
+    return strcmp((*(struct build_node **) a)->name, (*(struct build_node **) b)->name);
+}
+
+int short_char(unsigned char c) {
+    // The character a short name has for c, or 0 if it can't have one
+    if(c >= 'a' && c <= 'z')
+        return c - 'a' + 'A';
+    if((c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || (c >= 128 ? 0 : strchr("!#$%&'()-@^_`{}~", c) != NULL))
+        return c;
+    return 0;
+}
+
+int fits_short_name(const char *name) {
+    // Whether name is already a short name (upper case NAME.EXT), so needs no long name
+    const char *dot = strrchr(name, '.');
+    int i, base = dot ? dot - name : (int) strlen(name), ext = dot ? (int) strlen(dot + 1) : 0;
+    if(base < 1 || base > 8 || ext > 3 || (dot && ext == 0))
+        return 0;
+    for(i = 0; name[i]; i++)
+        if(i != base && (short_char(name[i]) == 0 || short_char(name[i]) != name[i]))
+            return 0;
+    return 1;
+}
+
+void make_short_name(struct build_node *dir, int index) {
+    // Gives a child of dir its 11 byte short name: the name itself if it is one, or else
+    // the first characters of it with ~N added, N the first number no sibling has taken.
+    // Siblings whose names are short names must have theirs already, so that a generated
+    // name can't take one of them.
+    struct build_node *node = dir->children[index];
+    const char *name = node->name, *dot = strrchr(name, '.');
+    char base[9], ext[4], tail[9];
+    int i, k, nb = 0, ne = 0, taken;
+    uint32_t n;
+
+    if(dot == name)
+        dot = NULL;  // a leading dot doesn't start an extension
+    for(i = 0; name + i != dot && name[i] && nb < 8; i++)
+        if(short_char(name[i]))
+            base[nb++] = short_char(name[i]);
+        else if(name[i] != '.' && name[i] != ' ')
+            base[nb++] = '_';
+    for(i = 1; dot && dot[i] && ne < 3; i++)
+        if(short_char(dot[i]))
+            ext[ne++] = short_char(dot[i]);
+        else if(dot[i] != ' ')
+            ext[ne++] = '_';
+    if(nb == 0)
+        base[nb++] = '_';
+    memset(node->short_name, ' ', 11);
+    memcpy(node->short_name + 8, ext, ne);
+    if(fits_short_name(name)) {
+        memcpy(node->short_name, base, nb);
+        return;
+    }
+    for(n = 1; ; n++) {
+        int tl = snprintf(tail, sizeof(tail), "~%u", n);
+        memset(node->short_name, ' ', 8);
+        memcpy(node->short_name, base, nb + tl > 8 ? 8 - tl : nb);
+        memcpy(node->short_name + (nb + tl > 8 ? 8 - tl : nb), tail, tl);
+        for(k = 0, taken = 0; k < dir->nchildren && !taken; k++)
+            taken = k != index && memcmp(dir->children[k]->short_name, node->short_name, 11) == 0;  // all zeros until settled
+        if(!taken)
+            return;
+    }
+}
+
+int utf16_name(const char *name, uint16_t *units) {
+    // Converts a UTF-8 name to the UTF-16 of a long name. Returns the number of units,
+    // or -1 if it is too long.
+    const unsigned char *p = (const unsigned char *) name;
+    uint32_t c;
+    int n = 0;
+
+    while(*p) {
+        if(*p < 0x80) {
+            c = *p++;
+        } else if((*p & 0xe0) == 0xc0 && p[1]) {
+            c = ((p[0] & 0x1f) << 6) | (p[1] & 0x3f);
+            p += 2;
+        } else if((*p & 0xf0) == 0xe0 && p[1] && p[2]) {
+            c = ((p[0] & 0x0f) << 12) | ((p[1] & 0x3f) << 6) | (p[2] & 0x3f);
+            p += 3;
+        } else if((*p & 0xf8) == 0xf0 && p[1] && p[2] && p[3]) {
+            c = ((p[0] & 0x07) << 18) | ((p[1] & 0x3f) << 12) | ((p[2] & 0x3f) << 6) | (p[3] & 0x3f);
+            p += 4;
+        } else {
+            c = '_';  // not UTF-8
+            p++;
+        }
+        if(n + 2 > WIN_MAXLEN)
+            return -1;
+        if(c >= 0x10000) {
+            units[n++] = 0xd800 + ((c - 0x10000) >> 10);
+            units[n++] = 0xdc00 + ((c - 0x10000) & 0x3ff);
+        } else {
+            units[n++] = c;
+        }
+    }
+    return n;
+}
+
+struct build_node *scan_host(char *host, char *name, struct stat *st, struct build_plan *plan, int depth) {
+    // Reads a host directory tree into nodes, children sorted by name. Anything that
+    // isn't a regular file or a directory, or can't go in a FAT12 volume, is left out.
+    struct build_node *node = calloc(1, sizeof(struct build_node));
+    uint16_t units[WIN_MAXLEN + 1];
+    struct dirent *d;
+    struct stat cst;
+    char path[MAXPATHLEN + 1];
+    DIR *dir;
+    int i, n;
+
+    node->host = strdup(host);
+    node->name = strdup(name);
+    node->is_dir = S_ISDIR(st->st_mode);
+    node->size = node->is_dir ? 0 : st->st_size;
+    node->mtime = st->st_mtime;
+    if(!node->is_dir)
+        return node;
+    if(depth > MAXPATHLEN / 2 || !(dir = opendir(host))) {
+        fprintf(stderr, "Cannot read %s: %s\n", host, depth > MAXPATHLEN / 2 ? "too deep" : strerror(errno));
+        plan->skipped++;
+        return node;
+    }
+    while((d = readdir(dir))) {
+        if(strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0)
+            continue;
+        if(snprintf(path, sizeof(path), "%s/%s", host, d->d_name) >= (int) sizeof(path) || lstat(path, &cst) < 0
+           || !(S_ISDIR(cst.st_mode) || S_ISREG(cst.st_mode)) || cst.st_size > 0xffffffffLL || utf16_name(d->d_name, units) < 0) {
+            fprintf(stderr, "Leaving out %s\n", path);
+            plan->skipped++;
+            continue;
+        }
+        if(node->nchildren == 0 || (node->nchildren & (node->nchildren - 1)) == 0)
+            node->children = realloc(node->children, (node->nchildren ? 2 * node->nchildren : 1) * sizeof(struct build_node *));
+        node->children[node->nchildren++] = scan_host(path, d->d_name, &cst, plan, depth + 1);
+    }
+    closedir(dir);
+
+    // the names are settled in sorted order, so the same tree always gives the same image
+    if(node->nchildren)
+        qsort(node->children, node->nchildren, sizeof(struct build_node *), cmp_node);
+    node->entries = depth ? 2 : 0;  // "." and ".."
+    for(i = 0; i < node->nchildren; i++)
+        if(fits_short_name(node->children[i]->name))
+            make_short_name(node, i);
+    for(i = 0; i < node->nchildren; i++) {
+        if(!fits_short_name(node->children[i]->name))
+            make_short_name(node, i);
+        n = fits_short_name(node->children[i]->name) ? 0 : utf16_name(node->children[i]->name, units);
+        node->children[i]->slots = (n + WIN_CHARS - 1) / WIN_CHARS;
+        node->entries += 1 + node->children[i]->slots;
+    }
+    return node;
+}
+
+void put_fat12(uint8_t *fat, uint32_t n, uint16_t value) {
+    uint8_t *p = fat + n * 3 / 2;
+    if(n & 1) {
+        p[0] = (p[0] & 0x0f) | ((value & 0x0f) << 4);
+        p[1] = value >> 4;
+    } else {
+        p[0] = value;
+        p[1] = (p[1] & 0xf0) | ((value >> 8) & 0x0f);
+    }
+}
+
+void allocate(struct build_plan *plan, struct build_node *node, uint32_t bytes) {
+    // Gives node the next free clusters, chained one after the other
+    uint32_t i;
+    node->clusters = (bytes + plan->cluster_size - 1) / plan->cluster_size;
+    node->start = node->clusters ? plan->next : 0;
+    for(i = 0; i < node->clusters; i++) {
+        if(plan->next + i < plan->nclust)
+            put_fat12(plan->fat, plan->next + i, i + 1 == node->clusters ? FAT12_MASK : plan->next + i + 1);
+    }
+    plan->next += node->clusters;
+}
+
+void plan_dir(struct build_plan *plan, struct build_node *dir, int root) {
+    // Lays a directory out in the order it will be written: its own clusters, then its
+    // files, then each subdirectory in turn
+    int i;
+    if(!root)
+        allocate(plan, dir, dir->entries * sizeof(struct direntry));
+    for(i = 0; i < dir->nchildren; i++)
+        if(!dir->children[i]->is_dir)
+            allocate(plan, dir->children[i], dir->children[i]->size);
+    for(i = 0; i < dir->nchildren; i++)
+        if(dir->children[i]->is_dir)
+            plan_dir(plan, dir->children[i], 0);
+}
+
+void set_dos_time(struct direntry *de, time_t t) {
+    struct tm tm;
+    localtime_r(&t, &tm);
+    if(tm.tm_year < 80) {
+        memset(&tm, 0, sizeof(tm));  // DOS dates start in 1980
+        tm.tm_year = 80;
+        tm.tm_mday = 1;
+    }
+    putushort(de->deMDate, ((tm.tm_year - 80) << DD_YEAR_SHIFT) | ((tm.tm_mon + 1) << DD_MONTH_SHIFT) | (tm.tm_mday << DD_DAY_SHIFT));
+    putushort(de->deMTime, (tm.tm_hour << DT_HOURS_SHIFT) | (tm.tm_min << DT_MINUTES_SHIFT) | ((tm.tm_sec / 2) << DT_2SECONDS_SHIFT));
+    memcpy(de->deCDate, de->deMDate, 2);
+    memcpy(de->deCTime, de->deMTime, 2);
+    memcpy(de->deADate, de->deMDate, 2);
+}
+
+void fill_dir(struct build_node *dir, struct build_node *parent, uint8_t *buf) {
+    // Writes a directory's entries into buf (which is zeroed, so the end is marked):
+    // the dots unless it is the root, then each child, its long name slots first
+    static const int offsets[WIN_CHARS] = {1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30};
+    struct direntry *de = (struct direntry *) buf;
+    uint16_t units[WIN_MAXLEN + 1];
+    int i, k, slot, n;
+
+    if(parent) {
+        memcpy(de->deName, ".          ", 11);
+        de->deAttributes = ATTR_DIRECTORY;
+        putushort(de->deStartCluster, dir->start);
+        set_dos_time(de++, dir->mtime);
+        memcpy(de->deName, "..         ", 11);
+        de->deAttributes = ATTR_DIRECTORY;
+        putushort(de->deStartCluster, parent->start);  // 0 for the root
+        set_dos_time(de++, parent->mtime);
+    }
+    for(i = 0; i < dir->nchildren; i++) {
+        struct build_node *child = dir->children[i];
+        uint8_t sum;
+
+        memcpy(de->deName, child->short_name, 11);
+        sum = lfn_checksum(de);
+        n = child->slots ? utf16_name(child->name, units) : 0;
+        for(slot = child->slots; slot >= 1; slot--) {
+            // the last part comes first; the name ends with a 0 and is padded with 0xffff
+            struct winentry *we = (struct winentry *) de++;
+            we->weCnt = slot | (slot == child->slots ? WIN_LAST : 0);
+            we->weAttributes = ATTR_WIN95;
+            we->weChksum = sum;
+            for(k = 0; k < WIN_CHARS; k++) {
+                int c = (slot - 1) * WIN_CHARS + k;
+                uint16_t u = c < n ? units[c] : c == n ? 0x0000 : 0xffff;
+                ((uint8_t *) we)[offsets[k]] = u;
+                ((uint8_t *) we)[offsets[k] + 1] = u >> 8;
+            }
+        }
+        memcpy(de->deName, child->short_name, 11);
+        de->deAttributes = child->is_dir ? ATTR_DIRECTORY : ATTR_ARCHIVE;
+        putushort(de->deStartCluster, child->start);
+        putulong(de->deFileSize, child->size);
+        set_dos_time(de++, child->mtime);
+    }
+}
+
+void write_dir(struct build_out *out, struct build_plan *plan, struct build_node *dir, struct build_node *parent) {
+    // Writes the data area in the order plan_dir allocated it
+    uint8_t *buf;
+    int i;
+
+    if(parent) {
+        buf = calloc(dir->clusters, plan->cluster_size);
+        fill_dir(dir, parent, buf);
+        out_write(out, buf, dir->clusters * plan->cluster_size);
+        free(buf);
+    }
+    for(i = 0; i < dir->nchildren; i++)
+        if(!dir->children[i]->is_dir)
+            out_file(out, dir->children[i], dir->children[i]->clusters * plan->cluster_size);
+    for(i = 0; i < dir->nchildren; i++)
+        if(dir->children[i]->is_dir)
+            write_dir(out, plan, dir->children[i], dir);
+}
+
+void free_node(struct build_node *node) {
+    int i;
+    for(i = 0; i < node->nchildren; i++)
+        free_node(node->children[i]);
+    free(node->children);
+    free(node->host);
+    free(node->name);
+    free(node);
+}
+
+int build_image(char *imagename, char *hostdir, struct build_geometry *g) {
+    // Makes a new FAT12 image with geometry g holding a copy of the host directory
+    // hostdir. Everything is planned first - the tree, every cluster and the FAT - so
+    // that the image can then be written in one pass from the boot sector to the last
+    // file, through a large buffer. Each file is contiguous. Returns 0, or 1 on failure.
+    struct build_plan plan;
+    struct build_out out = {-1, NULL, 0, 0};
+    struct build_node *root;
+    struct bootsector33 *bs;
+    struct byte_bpb33 *bpb;
+    struct stat st;
+    uint8_t *sector, *rootdir;
+    uint32_t bps = g->bytes_per_sector, data_start, i;
+
+    if(bps < 512 || bps > 4096 || (bps & (bps - 1)) || !g->cluster_sectors || g->cluster_sectors > 128
+       || (g->cluster_sectors & (g->cluster_sectors - 1)) || !g->root_entries || g->sectors > 0xffff
+       || (g->root_entries * sizeof(struct direntry)) % bps) {
+        fprintf(stderr, "Impossible geometry: sector size a power of two from 512 to 4096, cluster sectors a power of two up to 128, "
+                "root entries filling whole sectors, and at most 65535 sectors\n");
+        return 1;
+    }
+    memset(&plan, 0, sizeof(plan));
+    plan.g = g;
+    plan.cluster_size = bps * g->cluster_sectors;
+    plan.root_secs = g->root_entries * sizeof(struct direntry) / bps;
+
+    // the FAT has to cover the clusters that are left once it takes its own room
+    for(plan.fat_secs = 1; ; plan.fat_secs++) {
+        data_start = 1 + 2 * plan.fat_secs + plan.root_secs;
+        if(data_start >= g->sectors) {
+            fprintf(stderr, "%u sectors leave no room for a data area\n", g->sectors);
+            return 1;
+        }
+        plan.nclust = (g->sectors - data_start) / g->cluster_sectors + CLUST_FIRST;
+        if((plan.nclust * 3 + 1) / 2 <= plan.fat_secs * bps)
+            break;
+    }
+    if(plan.nclust - CLUST_FIRST > FAT12_MAX_CLUSTERS) {
+        fprintf(stderr, "%u clusters is too many for FAT12; use bigger clusters\n", plan.nclust - CLUST_FIRST);
+        return 1;
+    }
+
+    if(stat(hostdir, &st) < 0 || !S_ISDIR(st.st_mode)) {
+        fprintf(stderr, "%s is not a directory\n", hostdir);
+        return 1;
+    }
+    root = scan_host(hostdir, "", &st, &plan, 0);
+    if(root->entries > (int) g->root_entries) {
+        fprintf(stderr, "The root directory needs %i entries, but has room for %u\n", root->entries, g->root_entries);
+        free_node(root);
+        return 1;
+    }
+    plan.fat = calloc(plan.fat_secs, bps);
+    put_fat12(plan.fat, 0, 0xf00 | BUILD_MEDIA);
+    put_fat12(plan.fat, 1, FAT12_MASK);
+    plan.next = CLUST_FIRST;
+    plan_dir(&plan, root, 1);
+    if(plan.next > plan.nclust) {
+        fprintf(stderr, "%s needs %u clusters, but the volume has %u\n", hostdir, plan.next - CLUST_FIRST, plan.nclust - CLUST_FIRST);
+        free(plan.fat);
+        free_node(root);
+        return 1;
+    }
+
+    out.fd = open(imagename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(out.fd < 0) {
+        fprintf(stderr, "Cannot create %s: %s\n", imagename, strerror(errno));
+        free(plan.fat);
+        free_node(root);
+        return 1;
+    }
+    out.buf = malloc(BUILD_BUFFER);
+
+    // boot sector
+    sector = calloc(1, bps);
+    bs = (struct bootsector33 *) sector;
+    bpb = (struct byte_bpb33 *) bs->bsBPB;
+    bs->bsJump[0] = 0xeb;
+    bs->bsJump[1] = 0x3c;
+    bs->bsJump[2] = 0x90;
+    memcpy(bs->bsOemName, "SCANDISK", 8);
+    putushort(bpb->bpbBytesPerSec, bps);
+    bpb->bpbSecPerClust = g->cluster_sectors;
+    putushort(bpb->bpbResSectors, 1);
+    bpb->bpbFATs = 2;
+    putushort(bpb->bpbRootDirEnts, g->root_entries);
+    putushort(bpb->bpbSectors, g->sectors);
+    bpb->bpbMedia = BUILD_MEDIA;
+    putushort(bpb->bpbFATsecs, plan.fat_secs);
+    putushort(bpb->bpbSecPerTrack, 18);
+    putushort(bpb->bpbHeads, 2);
+    bs->bsBootSectSig0 = BOOTSIG0;
+    bs->bsBootSectSig1 = BOOTSIG1;
+    out_write(&out, sector, bps);
+    free(sector);
+
+    // both FATs, the root directory, then the data area
+    for(i = 0; i < 2; i++)
+        out_write(&out, plan.fat, plan.fat_secs * bps);
+    rootdir = calloc(plan.root_secs, bps);
+    fill_dir(root, NULL, rootdir);
+    out_write(&out, rootdir, plan.root_secs * bps);
+    free(rootdir);
+    write_dir(&out, &plan, root, NULL);
+    out_flush(&out);
+
+    // the free clusters at the end are left as a hole
+    if(!out.failed && ftruncate(out.fd, (off_t) g->sectors * bps) < 0)
+        out.failed = 1;
+    if(close(out.fd) < 0 || out.failed) {
+        fprintf(stderr, "Cannot write %s: %s\n", imagename, strerror(errno));
+        out.failed = 1;
+    } else {
+        printf("Build: %s, %u of %u clusters used, %i left out\n", imagename, plan.next - CLUST_FIRST, plan.nclust - CLUST_FIRST, plan.skipped);
+    }
+    free(out.buf);
+    free(plan.fat);
+    free_node(root);
+    return out.failed;
+}
@@ -0,0 +1,14 @@
+/* By: Bagus Maulana */
+
+/* prototypes for functions in build.c */
+
+// the shape of a new FAT12 volume
+struct build_geometry {
+    uint32_t sectors;           // in the whole volume
+    uint32_t bytes_per_sector;
+    uint32_t cluster_sectors;
+    uint32_t root_entries;
+};
+
+int parse_geometry(char *s, struct build_geometry *g);
+int build_image(char *imagename, char *hostdir, struct build_geometry *g);
@@ -0,0 +1,103 @@
+/* By: Bagus Maulana */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+
+#include "bootsect.h"
+#include "bpb.h"
+#include "direntry.h"
+#include "fat.h"
+#include "dos.h"
+#include "cancel.h"
+
+#define CLOCK_EVERY 256  // steps between looks at the clock
+
+struct scan_control *scan_control = NULL;
+
+long now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+void stop_scan(int sig) {
+    scan_control->stopped = SCAN_INTERRUPTED;
+}
+
+void start_scan_control(long timeout_ms, long interval_ms, long total, void (*progress)(struct scan_control *sc)) {
+    // From here on SIGINT and SIGTERM stop the walks instead of the process, so the scan
+    // can still say what it got through. A second signal kills it as usual.
+    struct sigaction sa;
+
+    scan_control = calloc(1, sizeof(struct scan_control));
+    scan_control->started = now_ms();
+    scan_control->deadline = timeout_ms > 0 ? scan_control->started + timeout_ms : 0;
+    scan_control->interval = interval_ms;
+    scan_control->next_report = scan_control->started + interval_ms;
+    scan_control->total = total;
+    scan_control->progress = progress ? progress : print_progress;
+
+    sa.sa_handler = stop_scan;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESETHAND;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+}
+
+int scan_step(void) {
+    // Called for each cluster the walks follow, from any thread. Every CLOCK_EVERY steps
+    // it checks the deadline and whether a progress report is due (one thread claims each
+    // report). Returns non-zero once the scan should give up.
+    struct scan_control *sc = scan_control;
+    long steps, now, due;
+
+    if(!sc)
+        return 0;
+    steps = __atomic_add_fetch(&sc->steps, 1, __ATOMIC_RELAXED);
+    if(steps % CLOCK_EVERY == 0 && (sc->deadline || sc->interval)) {
+        now = now_ms();
+        if(sc->deadline && now >= sc->deadline && scan_stopped() == SCAN_RUNNING)
+            __atomic_store_n(&sc->stopped, SCAN_DEADLINE, __ATOMIC_RELAXED);
+        due = __atomic_load_n(&sc->next_report, __ATOMIC_RELAXED);
+        if(sc->interval && now >= due
+           && __atomic_compare_exchange_n(&sc->next_report, &due, now + sc->interval, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            sc->progress(sc);
+    }
+    return scan_stopped();
+}
+
+void scan_dir(void) {
+    // Called as each directory is walked
+    if(scan_control)
+        __atomic_add_fetch(&scan_control->dirs, 1, __ATOMIC_RELAXED);
+}
+
+int scan_stopped(void) {
+    return scan_control ? __atomic_load_n(&scan_control->stopped, __ATOMIC_RELAXED) : SCAN_RUNNING;
+}
+
+const char *scan_stop_reason(void) {
+    switch(scan_stopped()) {
+    case SCAN_INTERRUPTED:
+        return "interrupted";
+    case SCAN_DEADLINE:
+        return "deadline passed";
+    default:
+        return "complete";
+    }
+}
+
+long scan_elapsed(void) {
+    return scan_control ? now_ms() - scan_control->started : 0;
+}
+
+void print_progress(struct scan_control *sc) {
+    // The default progress callback, on stderr so it stays out of the report
+    fprintf(stderr, "Progress: %li of %li clusters followed, %li directories, %.1fs\n",
+            __atomic_load_n(&sc->steps, __ATOMIC_RELAXED), sc->total,
+            __atomic_load_n(&sc->dirs, __ATOMIC_RELAXED), (now_ms() - sc->started) / 1000.0);
+}
@@ -0,0 +1,30 @@
+/* By: Bagus Maulana */
+
+/* prototypes for functions in cancel.c */
+
+#define SCAN_RUNNING 0
+#define SCAN_INTERRUPTED 1  // SIGINT or SIGTERM
+#define SCAN_DEADLINE 2     // --timeout ran out
+
+// what the walks check at every chain step and directory cluster
+struct scan_control {
+    volatile sig_atomic_t stopped;  // SCAN_RUNNING, or why the scan gave up
+    long started;                   // milliseconds on the monotonic clock
+    long deadline;                  // when to give up, or 0 for never
+    long interval;                  // between progress reports, or 0 for none
+    long next_report;
+    long steps;                     // clusters followed so far (a cross-linked one counts twice)
+    long dirs;                      // directories walked so far
+    long total;                     // clusters in the data area
+    void (*progress)(struct scan_control *sc);  // called every interval
+};
+
+extern struct scan_control *scan_control;  // NULL until start_scan_control
+
+void start_scan_control(long timeout_ms, long interval_ms, long total, void (*progress)(struct scan_control *sc));
+int scan_step(void);
+void scan_dir(void);
+int scan_stopped(void);
+const char *scan_stop_reason(void);
+long scan_elapsed(void);
+void print_progress(struct scan_control *sc);
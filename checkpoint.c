@@ -0,0 +1,341 @@
+/* By: Bagus Maulana */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "bootsect.h"
+#include "bpb.h"
+#include "direntry.h"
+#include "fat.h"
+#include "dos.h"
+#include "dos_scandisk.h"
+#include "checksum.h"
+#include "checkpoint.h"
+
+#define CHECKPOINT_MAGIC "FATCKP2"
+
+/*
+ * Checkpoint file layout: the header, the FAT sector hashes, then for each
+ * directory a ck_dir_header followed by its sectors, FAT dependency bitmap,
+ * items and visited runs.
+ */
+struct ck_header {
+    char magic[8];
+    int32_t nfatsecs;
+    int32_t ndirs;
+    int32_t clean;
+    int32_t files;
+};
+
+struct ck_dir_header {
+    uint16_t cluster;
+    int32_t nsectors, nitems, nruns;
+};
+
+void *grow(void *arr, int n, size_t size) {
+    // Makes room for element n of a dynamic array, doubling its capacity when it is full
+    if(n == 0 || (n & (n - 1)) == 0)
+        return realloc(arr, (n ? 2 * n : 1) * size);
+    return arr;
+}
+
+uint32_t hash_sector(uint32_t offset, uint8_t *image_buf, struct bpb33 *bpb) {
+    return crc32c(0, image_buf + offset, bpb->bpbBytesPerSec);
+}
+
+void add_fat_dep(uint8_t *deps, uint16_t cluster, struct bpb33 *bpb) {
+    // A FAT12 entry is a byte and a half, so it can straddle two FAT sectors
+    uint32_t offset = 3 * cluster / 2;
+    deps[offset / bpb->bpbBytesPerSec / 8] |= 1 << (offset / bpb->bpbBytesPerSec % 8);
+    offset++;
+    deps[offset / bpb->bpbBytesPerSec / 8] |= 1 << (offset / bpb->bpbBytesPerSec % 8);
+}
+
+struct checkpoint *new_checkpoint(uint8_t *image_buf, struct bpb33 *bpb) {
+    struct checkpoint *ck = calloc(1, sizeof(struct checkpoint));
+    uint32_t fat = bpb->bpbResSectors * bpb->bpbBytesPerSec;
+    int s;
+
+    ck->nfatsecs = bpb->bpbFATsecs;
+    ck->fat_hashes = malloc(ck->nfatsecs * sizeof(uint32_t));
+    ck->fat_changed = malloc(ck->nfatsecs);
+    for(s = 0; s < ck->nfatsecs; s++) {
+        ck->fat_hashes[s] = hash_sector(fat + s * bpb->bpbBytesPerSec, image_buf, bpb);
+        ck->fat_changed[s] = 1;
+    }
+    ck->any_fat_changed = 1;
+    return ck;
+}
+
+int read_dir(FILE *fp, struct ck_dir *dir, int depbytes) {
+    struct ck_dir_header h;
+    if(fread(&h, sizeof(h), 1, fp) != 1 || h.nsectors < 0 || h.nitems < 0 || h.nruns < 0)
+        return -1;
+    dir->cluster = h.cluster;
+    dir->nsectors = h.nsectors;
+    dir->nitems = h.nitems;
+    dir->nruns = h.nruns;
+    dir->sectors = malloc(h.nsectors * sizeof(struct ck_sector) + 1);
+    dir->fat_deps = malloc(depbytes);
+    dir->items = malloc(h.nitems * sizeof(struct ck_item) + 1);
+    dir->visited = malloc(h.nruns * sizeof(struct ck_run) + 1);
+    if(fread(dir->sectors, sizeof(struct ck_sector), h.nsectors, fp) != h.nsectors
+       || fread(dir->fat_deps, 1, depbytes, fp) != depbytes
+       || fread(dir->items, sizeof(struct ck_item), h.nitems, fp) != h.nitems
+       || fread(dir->visited, sizeof(struct ck_run), h.nruns, fp) != h.nruns)
+        return -1;
+    return 0;
+}
+
+struct checkpoint *load_checkpoint(char *path, uint8_t *image_buf, struct bpb33 *bpb) {
+    // Hashes the FAT of the image and compares it with the checkpoint saved by the last
+    // scan, if there is one. Without a usable checkpoint everything counts as changed.
+    struct checkpoint *ck = new_checkpoint(image_buf, bpb);
+    struct ck_header h;
+    uint32_t *old_hashes;
+    int s, d;
+    FILE *fp = fopen(path, "rb");
+
+    if(!fp)
+        return ck;
+    if(fread(&h, sizeof(h), 1, fp) != 1 || memcmp(h.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) != 0
+       || h.nfatsecs != ck->nfatsecs || h.ndirs < 0) {
+        fprintf(stderr, "Checkpoint %s doesn't match this image, ignoring it\n", path);
+        fclose(fp);
+        return ck;
+    }
+    old_hashes = malloc(ck->nfatsecs * sizeof(uint32_t));
+    if(fread(old_hashes, sizeof(uint32_t), ck->nfatsecs, fp) != ck->nfatsecs) {
+        fclose(fp);
+        free(old_hashes);
+        return ck;
+    }
+    ck->old = calloc(h.ndirs, sizeof(struct ck_dir));
+    for(d = 0; d < h.ndirs; d++) {
+        if(read_dir(fp, &ck->old[d], (ck->nfatsecs + 7) / 8) < 0) {
+            fprintf(stderr, "Checkpoint %s is truncated, ignoring it\n", path);
+            fclose(fp);
+            free(old_hashes);
+            ck->nold = 0;
+            return ck;
+        }
+    }
+    fclose(fp);
+
+    ck->nold = h.ndirs;
+    ck->old_clean = h.clean;
+    ck->old_files = h.files;
+    ck->any_fat_changed = 0;
+    for(s = 0; s < ck->nfatsecs; s++) {
+        ck->fat_changed[s] = ck->fat_hashes[s] != old_hashes[s];
+        ck->any_fat_changed |= ck->fat_changed[s];
+    }
+    free(old_hashes);
+    return ck;
+}
+
+int dir_unchanged(struct checkpoint *ck, struct ck_dir *dir, uint8_t *image_buf, struct bpb33 *bpb) {
+    // A directory can be reused if none of the FAT sectors its chains go through have
+    // changed (so its clusters and its files' clusters are the same) and its own
+    // sectors hash the same as before.
+    int s;
+    for(s = 0; s < ck->nfatsecs; s++) {
+        if(ck->fat_changed[s] && (dir->fat_deps[s / 8] & (1 << (s % 8))))
+            return 0;
+    }
+    for(s = 0; s < dir->nsectors; s++) {
+        if(hash_sector(dir->sectors[s].offset, image_buf, bpb) != dir->sectors[s].hash)
+            return 0;
+    }
+    return 1;
+}
+
+int checkpoint_unchanged(struct checkpoint *ck, uint8_t *image_buf, struct bpb33 *bpb) {
+    // Returns true if neither the FAT nor any directory changed since the checkpoint
+    int d;
+    if(!ck->nold || ck->any_fat_changed)
+        return 0;
+    for(d = 0; d < ck->nold; d++) {
+        if(!dir_unchanged(ck, &ck->old[d], image_buf, bpb))
+            return 0;
+    }
+    return 1;
+}
+
+int reuse_dir(struct checkpoint *ck, uint16_t cluster, int *visited, struct file **files, int *filectr, uint8_t *image_buf, struct bpb33 *bpb) {
+    // Called by follow_dir. If the directory is unchanged since the checkpoint, adds its
+    // files and visited clusters from the checkpoint instead of walking it, recurses into
+    // its subdirectories and returns true.
+    struct ck_dir *dir = NULL;
+    int d, i, k;
+
+    for(d = 0; d < ck->nold && !dir; d++) {
+        if(ck->old[d].cluster == cluster)
+            dir = &ck->old[d];
+    }
+    if(!dir || !dir_unchanged(ck, dir, image_buf, bpb))
+        return 0;
+
+    ck->new = grow(ck->new, ck->nnew, sizeof(struct ck_dir));
+    ck->new[ck->nnew++] = *dir;
+    ck->reused++;
+
+    visited[cluster] = 1;
+    for(i = 0; i < dir->nruns; i++) {
+        for(k = 0; k < dir->visited[i].len; k++)
+            visited[dir->visited[i].start + k] = 1;
+    }
+    for(i = 0; i < dir->nitems; i++) {
+        struct ck_item *item = &dir->items[i];
+        if(item->is_dir) {
+            follow_dir(item->start_cluster, visited, files, filectr, ck, NULL, image_buf, bpb);
+            continue;
+        }
+        struct file *f = add_file(files, filectr);
+        strcpy(f->name, item->name);
+        strcpy(f->ext, item->ext);
+        f->size = item->size;
+        f->start_cluster = item->start_cluster;
+        f->clusters = item->clusters;
+        f->de = (struct direntry *) (image_buf + item->de_offset);
+        f->lfn = item->lfn;
+    }
+    return 1;
+}
+
+int ck_begin_dir(struct checkpoint *ck, uint16_t cluster, uint8_t *image_buf, struct bpb33 *bpb) {
+    // Starts a new directory record for a directory follow_dir is about to walk, hashing
+    // its sectors as they are now. Returns the index of the record.
+    struct ck_dir *dir;
+    uint32_t start, len, off;
+    int nclust = num_clusters(bpb), steps;
+
+    ck->new = grow(ck->new, ck->nnew, sizeof(struct ck_dir));
+    dir = &ck->new[ck->nnew];
+    memset(dir, 0, sizeof(struct ck_dir));
+    dir->cluster = cluster;
+
+    if(cluster == MSDOSFSROOT) {
+        start = root_dir_addr(image_buf, bpb) - image_buf;
+        len = bpb->bpbRootDirEnts * sizeof(struct direntry);
+        for(off = 0; off < len; off += bpb->bpbBytesPerSec) {
+            dir->sectors = grow(dir->sectors, dir->nsectors, sizeof(struct ck_sector));
+            dir->sectors[dir->nsectors].offset = start + off;
+            dir->sectors[dir->nsectors].hash = hash_sector(start + off, image_buf, bpb);
+            dir->nsectors++;
+        }
+    } else {
+        for(steps = 0; steps < nclust && cluster >= CLUST_FIRST && cluster < nclust; steps++) {
+            start = cluster_to_addr(cluster, image_buf, bpb) - image_buf;
+            for(off = 0; off < bpb->bpbSecPerClust * bpb->bpbBytesPerSec; off += bpb->bpbBytesPerSec) {
+                dir->sectors = grow(dir->sectors, dir->nsectors, sizeof(struct ck_sector));
+                dir->sectors[dir->nsectors].offset = start + off;
+                dir->sectors[dir->nsectors].hash = hash_sector(start + off, image_buf, bpb);
+                dir->nsectors++;
+            }
+            cluster = get_fat_entry(cluster, image_buf, bpb);
+        }
+    }
+    return ck->nnew++;
+}
+
+void ck_add_item(struct checkpoint *ck, int d, int is_dir, struct direntry *de, struct file *f, uint8_t *image_buf) {
+    // Records a file (f) or a subdirectory (f is NULL) found in directory record d
+    struct ck_dir *dir = &ck->new[d];
+    struct ck_item *item;
+
+    dir->items = grow(dir->items, dir->nitems, sizeof(struct ck_item));
+    item = &dir->items[dir->nitems++];
+    memset(item, 0, sizeof(struct ck_item));
+    item->is_dir = is_dir;
+    item->de_offset = (uint8_t *) de - image_buf;
+    item->start_cluster = getushort(de->deStartCluster);
+    if(f) {
+        strcpy(item->name, f->name);
+        strcpy(item->ext, f->ext);
+        item->size = f->size;
+        item->clusters = f->clusters;
+        item->lfn = f->lfn;
+    }
+}
+
+void add_chain(struct ck_dir *dir, uint16_t cluster, int nclust, uint8_t *image_buf, struct bpb33 *bpb) {
+    // Adds a chain to a directory record's visited runs and FAT dependencies
+    int steps;
+    for(steps = 0; steps < nclust && cluster >= CLUST_FIRST && cluster < nclust; steps++) {
+        add_fat_dep(dir->fat_deps, cluster, bpb);
+        if(dir->nruns && dir->visited[dir->nruns - 1].start + dir->visited[dir->nruns - 1].len == cluster) {
+            dir->visited[dir->nruns - 1].len++;
+        } else {
+            dir->visited = grow(dir->visited, dir->nruns, sizeof(struct ck_run));
+            dir->visited[dir->nruns].start = cluster;
+            dir->visited[dir->nruns].len = 1;
+            dir->nruns++;
+        }
+        cluster = get_fat_entry(cluster, image_buf, bpb);
+    }
+}
+
+void ck_finish_walk(struct checkpoint *ck, uint8_t *image_buf, struct bpb33 *bpb) {
+    // Works out the FAT dependencies of the directories walked by this scan. This has to
+    // happen before anything is repaired, so that the record matches the hashes.
+    int nclust = num_clusters(bpb), d, i;
+    for(d = 0; d < ck->nnew; d++) {
+        struct ck_dir *dir = &ck->new[d];
+        if(dir->fat_deps)
+            continue;  // reused from the old checkpoint
+        dir->fat_deps = calloc((ck->nfatsecs + 7) / 8, 1);
+        if(dir->cluster != MSDOSFSROOT)
+            add_chain(dir, dir->cluster, nclust, image_buf, bpb);
+        for(i = 0; i < dir->nitems; i++) {
+            if(!dir->items[i].is_dir)
+                add_chain(dir, dir->items[i].start_cluster, nclust, image_buf, bpb);
+        }
+    }
+}
+
+int save_checkpoint(struct checkpoint *ck, char *path, int clean, int filectr) {
+    // Writes the checkpoint for the next run. Returns 0 on success.
+    struct ck_header h;
+    struct ck_dir_header dh;
+    char tmp[MAXPATHLEN + 8];
+    int d;
+    FILE *fp;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    fp = fopen(tmp, "wb");
+    if(!fp) {
+        fprintf(stderr, "Cannot write checkpoint %s: %s\n", tmp, strerror(errno));
+        return -1;
+    }
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+    h.nfatsecs = ck->nfatsecs;
+    h.ndirs = ck->nnew;
+    h.clean = clean;
+    h.files = filectr;
+    fwrite(&h, sizeof(h), 1, fp);
+    fwrite(ck->fat_hashes, sizeof(uint32_t), ck->nfatsecs, fp);
+    for(d = 0; d < ck->nnew; d++) {
+        struct ck_dir *dir = &ck->new[d];
+        memset(&dh, 0, sizeof(dh));
+        dh.cluster = dir->cluster;
+        dh.nsectors = dir->nsectors;
+        dh.nitems = dir->nitems;
+        dh.nruns = dir->nruns;
+        fwrite(&dh, sizeof(dh), 1, fp);
+        fwrite(dir->sectors, sizeof(struct ck_sector), dir->nsectors, fp);
+        fwrite(dir->fat_deps, 1, (ck->nfatsecs + 7) / 8, fp);
+        fwrite(dir->items, sizeof(struct ck_item), dir->nitems, fp);
+        fwrite(dir->visited, sizeof(struct ck_run), dir->nruns, fp);
+    }
+    if(fclose(fp) != 0 || rename(tmp, path) != 0) {
+        fprintf(stderr, "Cannot write checkpoint %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,53 @@
+/* By: Bagus Maulana */
+
+/* prototypes for functions in checkpoint.c */
+
+struct ck_item {
+    int is_dir;
+    uint32_t de_offset;  // offset of the direntry in the image
+    char name[9];
+    char ext[4];
+    uint32_t size;
+    uint16_t start_cluster;
+    int clusters;
+    struct lfn_run lfn;
+};
+
+struct ck_sector {
+    uint32_t offset;  // offset of the directory sector in the image
+    uint32_t hash;
+};
+
+struct ck_run {
+    uint16_t start;
+    uint16_t len;
+};
+
+struct ck_dir {
+    uint16_t cluster;
+    int nsectors, nitems, nruns;
+    struct ck_sector *sectors;  // the directory's own sectors
+    struct ck_item *items;      // files and subdirs, in direntry order
+    struct ck_run *visited;     // clusters used by the directory and its files
+    uint8_t *fat_deps;          // bitmap of FAT sectors holding those clusters' entries
+};
+
+struct checkpoint {
+    int nfatsecs;
+    uint32_t *fat_hashes;   // hashes of the FAT sectors in the image now
+    uint8_t *fat_changed;   // FAT sectors whose hash differs from the old checkpoint
+    int any_fat_changed;
+    int old_clean, old_files;
+    int nold, nnew, capnew;
+    struct ck_dir *old;     // loaded from the checkpoint file
+    struct ck_dir *new;     // recorded by this scan
+    int reused;             // directories taken from the old checkpoint
+};
+
+struct checkpoint *load_checkpoint(char *path, uint8_t *image_buf, struct bpb33 *bpb);
+int checkpoint_unchanged(struct checkpoint *ck, uint8_t *image_buf, struct bpb33 *bpb);
+int reuse_dir(struct checkpoint *ck, uint16_t cluster, int *visited, struct file **files, int *filectr, uint8_t *image_buf, struct bpb33 *bpb);
+int ck_begin_dir(struct checkpoint *ck, uint16_t cluster, uint8_t *image_buf, struct bpb33 *bpb);
+void ck_add_item(struct checkpoint *ck, int d, int is_dir, struct direntry *de, struct file *f, uint8_t *image_buf);
+void ck_finish_walk(struct checkpoint *ck, uint8_t *image_buf, struct bpb33 *bpb);
+int save_checkpoint(struct checkpoint *ck, char *path, int clean, int filectr);
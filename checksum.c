@@ -0,0 +1,271 @@
+/* By: Bagus Maulana */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "bootsect.h"
+#include "bpb.h"
+#include "direntry.h"
+#include "fat.h"
+#include "dos.h"
+#include "dos_scandisk.h"
+#include "checksum.h"
+#include "lfn.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define HAVE_SSE42_CRC
+#endif
+
+#define CRC32C_POLY 0x82f63b78  // reversed Castagnoli polynomial
+#define SIDECAR_MAGIC "FATCRC1"
+
+/*
+ * Sidecar file layout: the header, then a bitmap of the clusters that were
+ * allocated when the checksums were taken, then one CRC32C per cluster.
+ */
+struct sidecar_header {
+    char magic[8];
+    uint32_t nclust;
+    uint32_t cluster_size;
+};
+
+struct checksum_range {
+    uint16_t first, last;
+    uint32_t *crcs;
+    uint8_t *allocated;
+    uint32_t zero_crc;  // checksum of a cluster of zeros, for clusters in holes
+    struct hole_map *holes;
+    uint8_t *image_buf;
+    struct bpb33 *bpb;
+};
+
+uint32_t crc_table[256];
+
+uint32_t crc32c_table(uint32_t crc, const uint8_t *buf, size_t len) {
+    while(len--)
+        crc = crc_table[(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+#ifdef HAVE_SSE42_CRC
+__attribute__((target("sse4.2")))
+uint32_t crc32c_sse42(uint32_t crc, const uint8_t *buf, size_t len) {
+#ifdef __x86_64__
+    uint64_t crc64 = crc;
+    uint64_t word;
+    while(len >= 8) {
+        memcpy(&word, buf, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+        buf += 8;
+        len -= 8;
+    }
+    crc = (uint32_t) crc64;
+#endif
+    while(len--)
+        crc = _mm_crc32_u8(crc, *buf++);
+    return crc;
+}
+#endif
+
+uint32_t (*crc32c_impl)(uint32_t, const uint8_t *, size_t) = NULL;
+
+void crc32c_init() {
+    // Fills in the table for the fallback and picks the SSE4.2 instruction if the CPU has it
+    uint32_t i, j, crc;
+    for(i = 0; i < 256; i++) {
+        crc = i;
+        for(j = 0; j < 8; j++)
+            crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        crc_table[i] = crc;
+    }
+    crc32c_impl = crc32c_table;
+#ifdef HAVE_SSE42_CRC
+    if(__builtin_cpu_supports("sse4.2"))
+        crc32c_impl = crc32c_sse42;
+#endif
+}
+
+uint32_t crc32c(uint32_t crc, const uint8_t *buf, size_t len) {
+    // Standard CRC32C of buf; pass 0 as crc to start a new checksum
+    if(!crc32c_impl)
+        crc32c_init();
+    return ~crc32c_impl(~crc, buf, len);
+}
+
+void *checksum_range(void *arg) {
+    struct checksum_range *r = arg;
+    int cluster_size = r->bpb->bpbBytesPerSec * r->bpb->bpbSecPerClust;
+    uint16_t c, entry;
+
+    for(c = r->first; c < r->last; c++) {
+        entry = get_fat_entry(c, r->image_buf, r->bpb);
+        r->allocated[c] = entry != CLUST_FREE && entry != (FAT12_MASK & CLUST_BAD);
+        if(!r->allocated[c])
+            r->crcs[c] = 0;
+        else if(cluster_is_hole(r->holes, c, r->image_buf, r->bpb))
+            r->crcs[c] = r->zero_crc;
+        else
+            r->crcs[c] = crc32c(0, cluster_to_addr(c, r->image_buf, r->bpb), cluster_size);
+    }
+    return NULL;
+}
+
+void checksum_clusters(uint32_t *crcs, uint8_t *allocated, struct hole_map *holes, int nthreads, uint8_t *image_buf, struct bpb33 *bpb) {
+    // Computes the CRC32C of every allocated cluster, one cluster range per thread.
+    // crcs and allocated need num_clusters(bpb) entries.
+    int nclust = num_clusters(bpb), cluster_size = bpb->bpbBytesPerSec * bpb->bpbSecPerClust;
+    int per_thread, t;
+    struct checksum_range *ranges;
+    pthread_t *threads;
+    int *started;
+    uint8_t *zeros = calloc(1, cluster_size);
+
+    if(nthreads < 1)
+        nthreads = 1;
+    crc32c_init();  // before any threads start
+    ranges = calloc(nthreads, sizeof(struct checksum_range));
+    threads = malloc(nthreads * sizeof(pthread_t));
+    started = calloc(nthreads, sizeof(int));
+    per_thread = (nclust - CLUST_FIRST + nthreads - 1) / nthreads;
+    memset(crcs, 0, CLUST_FIRST * sizeof(uint32_t));
+    memset(allocated, 0, CLUST_FIRST);
+
+    for(t = 0; t < nthreads; t++) {
+        ranges[t].first = CLUST_FIRST + t * per_thread;
+        ranges[t].last = ranges[t].first + per_thread < nclust ? ranges[t].first + per_thread : nclust;
+        if(ranges[t].first >= ranges[t].last)
+            ranges[t].first = ranges[t].last;
+        ranges[t].crcs = crcs;
+        ranges[t].allocated = allocated;
+        ranges[t].zero_crc = crc32c(0, zeros, cluster_size);
+        ranges[t].holes = holes;
+        ranges[t].image_buf = image_buf;
+        ranges[t].bpb = bpb;
+        started[t] = pthread_create(&threads[t], NULL, checksum_range, &ranges[t]) == 0;
+        if(!started[t])
+            checksum_range(&ranges[t]);
+    }
+    for(t = 0; t < nthreads; t++) {
+        if(started[t])
+            pthread_join(threads[t], NULL);
+    }
+
+    free(zeros);
+    free(started);
+    free(threads);
+    free(ranges);
+}
+
+int write_checksums(char *path, uint32_t *crcs, uint8_t *allocated, struct bpb33 *bpb) {
+    // Writes the sidecar file, replacing any old one. Returns 0 on success.
+    struct sidecar_header header;
+    int nclust = num_clusters(bpb), c;
+    uint8_t *bitmap = calloc((nclust + 7) / 8, 1);
+    char tmp[MAXPATHLEN + 8];
+    FILE *fp;
+
+    for(c = 0; c < nclust; c++) {
+        if(allocated[c])
+            bitmap[c / 8] |= 1 << (c % 8);
+    }
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SIDECAR_MAGIC, sizeof(SIDECAR_MAGIC));
+    header.nclust = nclust;
+    header.cluster_size = bpb->bpbBytesPerSec * bpb->bpbSecPerClust;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    fp = fopen(tmp, "wb");
+    if(!fp) {
+        fprintf(stderr, "Cannot write checksum file %s: %s\n", tmp, strerror(errno));
+        free(bitmap);
+        return -1;
+    }
+    fwrite(&header, sizeof(header), 1, fp);
+    fwrite(bitmap, 1, (nclust + 7) / 8, fp);
+    fwrite(crcs, sizeof(uint32_t), nclust, fp);
+    free(bitmap);
+    if(fclose(fp) != 0 || rename(tmp, path) != 0) {
+        fprintf(stderr, "Cannot write checksum file %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+int verify_checksums(char *path, uint32_t *crcs, uint8_t *allocated, struct file *files, int filectr, uint8_t *image_buf, struct bpb33 *bpb) {
+    // Compares fresh checksums against the sidecar file and reports changed clusters
+    // by owning file. Only clusters allocated both then and now are compared.
+    // Returns the number of changed clusters, or -1 if there is no usable sidecar.
+    struct sidecar_header header;
+    int nclust = num_clusters(bpb), c, f, steps, changed = 0, printed;
+    uint8_t *bitmap, *diff;
+    uint32_t *old;
+    char display[4 * WIN_MAXLEN + 1];
+    FILE *fp = fopen(path, "rb");
+
+    if(!fp)
+        return -1;
+    if(fread(&header, sizeof(header), 1, fp) != 1 || memcmp(header.magic, SIDECAR_MAGIC, sizeof(SIDECAR_MAGIC)) != 0
+       || header.nclust != nclust || header.cluster_size != bpb->bpbBytesPerSec * bpb->bpbSecPerClust) {
+        fprintf(stderr, "Checksum file %s doesn't match this image\n", path);
+        fclose(fp);
+        return -1;
+    }
+    bitmap = malloc((nclust + 7) / 8);
+    old = malloc(nclust * sizeof(uint32_t));
+    if(fread(bitmap, 1, (nclust + 7) / 8, fp) != (nclust + 7) / 8 || fread(old, sizeof(uint32_t), nclust, fp) != nclust) {
+        fprintf(stderr, "Checksum file %s is truncated\n", path);
+        fclose(fp);
+        free(bitmap);
+        free(old);
+        return -1;
+    }
+    fclose(fp);
+
+    diff = calloc(nclust, 1);
+    for(c = CLUST_FIRST; c < nclust; c++) {
+        if(allocated[c] && (bitmap[c / 8] & (1 << (c % 8))) && crcs[c] != old[c]) {
+            diff[c] = 1;
+            changed++;
+        }
+    }
+
+    for(f = 0; f < filectr && changed; f++) {
+        printed = 0;
+        c = files[f].start_cluster;
+        for(steps = 0; steps < nclust && c >= CLUST_FIRST && c < nclust; steps++) {
+            if(diff[c]) {
+                if(!printed++) {
+                    file_display_name(&files[f], display, sizeof(display), image_buf, bpb);
+                    printf("Changed: %s", display);
+                }
+                printf(" %i", c);
+                diff[c] = 0;
+            }
+            c = get_fat_entry(c, image_buf, bpb);
+        }
+        if(printed)
+            printf("\n");
+    }
+    printed = 0;
+    for(c = CLUST_FIRST; c < nclust; c++) {
+        if(diff[c]) {
+            if(!printed++)
+                printf("Changed outside files:");
+            printf(" %i", c);
+        }
+    }
+    if(printed)
+        printf("\n");
+
+    free(diff);
+    free(bitmap);
+    free(old);
+    return changed;
+}
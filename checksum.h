@@ -0,0 +1,8 @@
+/* By: Bagus Maulana */
+
+/* prototypes for functions in checksum.c */
+
+uint32_t crc32c(uint32_t crc, const uint8_t *buf, size_t len);
+void checksum_clusters(uint32_t *crcs, uint8_t *allocated, struct hole_map *holes, int nthreads, uint8_t *image_buf, struct bpb33 *bpb);
+int write_checksums(char *path, uint32_t *crcs, uint8_t *allocated, struct bpb33 *bpb);
+int verify_checksums(char *path, uint32_t *crcs, uint8_t *allocated, struct file *files, int filectr, uint8_t *image_buf, struct bpb33 *bpb);
@@ -0,0 +1,155 @@
+/* By: Bagus Maulana */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "classify.h"
+
+#define SIG_BYTES 16  // signatures are matched against the first 16 bytes of a file
+
+/*
+ * A file signature: the first SIG_BYTES bytes of the file, ANDed with mask,
+ * must equal pattern. length, if set, reads the file's true length from its
+ * header (0 if it doesn't make sense).
+ */
+struct signature {
+    const char *ext;
+    uint8_t pattern[SIG_BYTES];
+    uint8_t mask[SIG_BYTES];
+    uint32_t (*length)(uint8_t *data);
+    int next;  // next signature with the same first byte
+};
+
+uint32_t le32(uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+uint32_t bmp_length(uint8_t *data) {
+    return le32(data + 2);
+}
+
+uint32_t riff_length(uint8_t *data) {
+    return le32(data + 4) + 8;
+}
+
+uint32_t exe_length(uint8_t *data) {
+    // MZ header: number of 512 byte pages, and bytes used in the last one
+    uint32_t last = data[2] | (data[3] << 8), pages = data[4] | (data[5] << 8);
+    if(!pages)
+        return 0;
+    return last ? (pages - 1) * 512 + last : pages * 512;
+}
+
+#define FF16 {0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff}
+
+struct signature signatures[] = {
+    {"PNG", {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'}, {0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff}, NULL},
+    {"JPG", {0xff, 0xd8, 0xff}, {0xff, 0xff, 0xff}, NULL},
+    {"GIF", {'G', 'I', 'F', '8', '7', 'a'}, {0xff, 0xff, 0xff, 0xff, 0xff, 0xff}, NULL},
+    {"GIF", {'G', 'I', 'F', '8', '9', 'a'}, {0xff, 0xff, 0xff, 0xff, 0xff, 0xff}, NULL},
+    {"BMP", {'B', 'M', 0, 0, 0, 0, 0, 0, 0, 0}, {0xff, 0xff, 0, 0, 0, 0, 0xff, 0xff, 0xff, 0xff}, bmp_length},
+    {"WAV", {'R', 'I', 'F', 'F', 0, 0, 0, 0, 'W', 'A', 'V', 'E'}, {0xff, 0xff, 0xff, 0xff, 0, 0, 0, 0, 0xff, 0xff, 0xff, 0xff}, riff_length},
+    {"AVI", {'R', 'I', 'F', 'F', 0, 0, 0, 0, 'A', 'V', 'I', ' '}, {0xff, 0xff, 0xff, 0xff, 0, 0, 0, 0, 0xff, 0xff, 0xff, 0xff}, riff_length},
+    {"PDF", {'%', 'P', 'D', 'F', '-'}, {0xff, 0xff, 0xff, 0xff, 0xff}, NULL},
+    {"ZIP", {'P', 'K', 3, 4}, {0xff, 0xff, 0xff, 0xff}, NULL},
+    {"GZ", {0x1f, 0x8b, 8}, {0xff, 0xff, 0xff}, NULL},
+    {"7Z", {'7', 'z', 0xbc, 0xaf, 0x27, 0x1c}, {0xff, 0xff, 0xff, 0xff, 0xff, 0xff}, NULL},
+    {"RAR", {'R', 'a', 'r', '!', 0x1a, 7}, {0xff, 0xff, 0xff, 0xff, 0xff, 0xff}, NULL},
+    {"ARJ", {0x60, 0xea}, {0xff, 0xff}, NULL},
+    {"LZH", {0, 0, '-', 'l', 'h', 0, '-'}, {0, 0, 0xff, 0xff, 0xff, 0, 0xff}, NULL},
+    {"DOC", {0xd0, 0xcf, 0x11, 0xe0, 0xa1, 0xb1, 0x1a, 0xe1}, {0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff}, NULL},
+    {"RTF", {'{', '\\', 'r', 't', 'f'}, {0xff, 0xff, 0xff, 0xff, 0xff}, NULL},
+    {"TIF", {'I', 'I', '*', 0}, {0xff, 0xff, 0xff, 0xff}, NULL},
+    {"TIF", {'M', 'M', 0, '*'}, {0xff, 0xff, 0xff, 0xff}, NULL},
+    {"MID", {'M', 'T', 'h', 'd'}, {0xff, 0xff, 0xff, 0xff}, NULL},
+    {"EXE", {'M', 'Z'}, {0xff, 0xff}, exe_length},
+};
+
+#define NSIGNATURES (sizeof(signatures) / sizeof(signatures[0]))
+
+int by_first_byte[256];  // first signature for each first byte, -1 for none
+int any_first_byte = -1; // signatures that don't fix the first byte
+int buckets_built = 0;
+
+void build_buckets() {
+    // Chains the signatures by their first byte, so each file is only compared
+    // against the few signatures that can match it
+    int i;
+    for(i = 0; i < 256; i++)
+        by_first_byte[i] = -1;
+    for(i = NSIGNATURES - 1; i >= 0; i--) {
+        if(signatures[i].mask[0] == 0xff) {
+            signatures[i].next = by_first_byte[signatures[i].pattern[0]];
+            by_first_byte[signatures[i].pattern[0]] = i;
+        } else {
+            signatures[i].next = any_first_byte;
+            any_first_byte = i;
+        }
+    }
+    buckets_built = 1;
+}
+
+int matches(struct signature *sig, uint8_t *head) {
+#ifdef __SSE2__
+    __m128i data = _mm_loadu_si128((__m128i *) head);
+    __m128i masked = _mm_and_si128(data, _mm_loadu_si128((__m128i *) sig->mask));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(masked, _mm_loadu_si128((__m128i *) sig->pattern))) == 0xffff;
+#else
+    int i;
+    for(i = 0; i < SIG_BYTES; i++) {
+        if((head[i] & sig->mask[i]) != sig->pattern[i])
+            return 0;
+    }
+    return 1;
+#endif
+}
+
+int is_text(uint8_t *data, uint32_t avail) {
+    // Plain ASCII text: printable characters, whitespace and DOS end-of-file (^Z) only
+    uint32_t i;
+    for(i = 0; i < avail; i++) {
+        if(data[i] == 0 && i > 0)
+            return 1;  // rest of the last cluster is padding
+        if((data[i] < 0x20 && data[i] != '\t' && data[i] != '\n' && data[i] != '\r' && data[i] != '\f' && data[i] != 0x1a)
+           || data[i] > 0x7e)
+            return 0;
+    }
+    return avail > 0;
+}
+
+const char *matched(struct signature *sig, uint8_t *data, uint32_t *length) {
+    if(sig->length && sig->length(data) > 0)
+        *length = sig->length(data);
+    return sig->ext;
+}
+
+const char *classify_cluster(uint8_t *data, uint32_t avail, uint32_t *length) {
+    // Guesses the type of a lost file from its first avail bytes (normally its first
+    // cluster). Returns an extension, or NULL if the type isn't known. If the file's
+    // header records its length, *length is set to it, otherwise it is left alone.
+    uint8_t head[SIG_BYTES];
+    int i;
+
+    if(!buckets_built)
+        build_buckets();
+    memset(head, 0, SIG_BYTES);
+    memcpy(head, data, avail < SIG_BYTES ? avail : SIG_BYTES);
+
+    // the signatures that start with this byte, then the ones that can start with any
+    for(i = by_first_byte[head[0]]; i >= 0; i = signatures[i].next) {
+        if(matches(&signatures[i], head))
+            return matched(&signatures[i], data, length);
+    }
+    for(i = any_first_byte; i >= 0; i = signatures[i].next) {
+        if(matches(&signatures[i], head))
+            return matched(&signatures[i], data, length);
+    }
+    if(is_text(data, avail))
+        return "TXT";
+    return NULL;
+}
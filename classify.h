@@ -0,0 +1,5 @@
+/* By: Bagus Maulana */
+
+/* prototypes for functions in classify.c */
+
+const char *classify_cluster(uint8_t *data, uint32_t avail, uint32_t *length);
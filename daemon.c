@@ -0,0 +1,372 @@
+/* By: Bagus Maulana */
+
+#define _GNU_SOURCE  // for pipe2
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <libgen.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/inotify.h>
+
+#include "bootsect.h"
+#include "bpb.h"
+#include "direntry.h"
+#include "fat.h"
+#include "dos.h"
+#include "dos_scandisk.h"
+#include "daemon.h"
+
+struct job {
+    char path[MAXPATHLEN + 1];
+    struct timespec queued;
+};
+
+struct daemon {
+    struct daemon_config *config;
+    char self[MAXPATHLEN + 1];      // this program, which each scan runs as
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    struct job *queue;              // ring buffer of config->queue_size jobs
+    int head, count;
+    int active, done, failed, deferred;
+    int overflowed;                 // images were left in a watched directory as the queue was full
+    double total_latency, max_latency;  // from queueing to the report, in seconds
+    int done_pipe[2];               // workers write a byte here when they finish a job, and so does stop_daemon
+};
+
+volatile sig_atomic_t stopping = 0;
+int wake_fd = -1;  // the write end of done_pipe, so a signal wakes the main loop's poll
+
+void stop_daemon(int sig) {
+    stopping = 1;
+    if(wake_fd >= 0 && write(wake_fd, "", 1) < 0)
+        ;  // the pipe is full, so poll returns anyway
+}
+
+double seconds_since(struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+void report_path(struct daemon *dm, char *image, char *path, int len, char *suffix) {
+    // Where the report for an image goes: the outbox, under the image's name
+    char copy[MAXPATHLEN + 1];
+    strncpy(copy, image, MAXPATHLEN);
+    copy[MAXPATHLEN] = '\0';
+    snprintf(path, len, "%s/%s.txt%s", dm->config->outbox, basename(copy), suffix);
+}
+
+int enqueue(struct daemon *dm, char *path) {
+    // Adds an image to the queue, unless it is already waiting. Returns -1 if the queue
+    // is full (the image stays where it is and is picked up again later).
+    int i, status = 0;
+
+    pthread_mutex_lock(&dm->lock);
+    for(i = 0; i < dm->count; i++) {
+        if(strcmp(dm->queue[(dm->head + i) % dm->config->queue_size].path, path) == 0)
+            break;
+    }
+    if(i < dm->count) {
+        // already queued
+    } else if(dm->count == dm->config->queue_size) {
+        dm->deferred++;
+        dm->overflowed = 1;
+        status = -1;
+    } else {
+        struct job *job = &dm->queue[(dm->head + dm->count) % dm->config->queue_size];
+        strncpy(job->path, path, MAXPATHLEN);
+        job->path[MAXPATHLEN] = '\0';
+        clock_gettime(CLOCK_MONOTONIC, &job->queued);
+        dm->count++;
+        pthread_cond_signal(&dm->not_empty);
+    }
+    pthread_mutex_unlock(&dm->lock);
+    return status;
+}
+
+int run_scan(struct daemon *dm, char *image) {
+    // Checks one image in a new process (as with --dry-run, the image isn't changed),
+    // writing the report to the outbox. Returns the scan's exit status, or -1.
+    char tmppath[MAXPATHLEN + 1], outpath[MAXPATHLEN + 1];
+    int fd, status;
+    pid_t pid;
+
+    report_path(dm, image, tmppath, sizeof(tmppath), ".tmp");
+    report_path(dm, image, outpath, sizeof(outpath), "");
+    fd = open(tmppath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);  // so other scans don't inherit it
+    if(fd < 0)
+        return -1;
+    pid = fork();
+    if(pid == 0) {
+        // the worker has SIGINT and SIGTERM blocked; the scan needs them to cancel itself
+        sigset_t none;
+        sigemptyset(&none);
+        sigprocmask(SIG_SETMASK, &none, NULL);
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+        close(fd);
+        if(dm->config->timeout) {
+            // a pathological image gives up with a partial report instead of holding on to the worker
+            char timeout[32];
+            snprintf(timeout, sizeof(timeout), "%.3f", dm->config->timeout / 1000.0);
+            execl(dm->self, dm->self, "--dry-run", "--threads", "1", "--timeout", timeout, image, (char *) NULL);
+        } else {
+            execl(dm->self, dm->self, "--dry-run", "--threads", "1", image, (char *) NULL);
+        }
+        _exit(127);
+    }
+    close(fd);
+    if(pid < 0 || waitpid(pid, &status, 0) < 0) {
+        unlink(tmppath);
+        return -1;
+    }
+    rename(tmppath, outpath);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+void *daemon_worker(void *arg) {
+    // Takes images off the queue and scans them, until the daemon stops
+    struct daemon *dm = arg;
+    struct job job;
+    double latency;
+    int status;
+
+    while(1) {
+        pthread_mutex_lock(&dm->lock);
+        while(!dm->count && !stopping)
+            pthread_cond_wait(&dm->not_empty, &dm->lock);
+        if(stopping) {
+            pthread_mutex_unlock(&dm->lock);
+            return NULL;
+        }
+        job = dm->queue[dm->head];
+        dm->head = (dm->head + 1) % dm->config->queue_size;
+        dm->count--;
+        dm->active++;
+        pthread_mutex_unlock(&dm->lock);
+
+        status = run_scan(dm, job.path);
+        latency = seconds_since(&job.queued);
+
+        pthread_mutex_lock(&dm->lock);
+        dm->active--;
+        if(status == 0)
+            dm->done++;
+        else
+            dm->failed++;
+        dm->total_latency += latency;
+        if(latency > dm->max_latency)
+            dm->max_latency = latency;
+        pthread_mutex_unlock(&dm->lock);
+        if(write(dm->done_pipe[1], "", 1) < 0)
+            ;  // the main loop will rescan anyway when the next event comes
+    }
+}
+
+int needs_scan(struct daemon *dm, char *path) {
+    // An image needs scanning if it has no report yet, or has changed since its report
+    char report[MAXPATHLEN + 1];
+    struct stat image, out;
+    if(stat(path, &image) < 0 || !S_ISREG(image.st_mode))
+        return 0;
+    report_path(dm, path, report, sizeof(report), "");
+    return stat(report, &out) < 0 || out.st_mtime < image.st_mtime;
+}
+
+void rescan_dirs(struct daemon *dm) {
+    // Queues the images in the watched directories that haven't been scanned. Done at
+    // the start, and after the queue was full, to pick up what was left waiting.
+    char path[MAXPATHLEN + 1];
+    struct dirent *d;
+    DIR *dir;
+    int w;
+
+    pthread_mutex_lock(&dm->lock);
+    dm->overflowed = 0;
+    pthread_mutex_unlock(&dm->lock);
+    for(w = 0; w < dm->config->nwatch; w++) {
+        dir = opendir(dm->config->watch[w]);
+        if(!dir)
+            continue;
+        while((d = readdir(dir))) {
+            if(d->d_name[0] == '.')
+                continue;
+            if(snprintf(path, sizeof(path), "%s/%s", dm->config->watch[w], d->d_name) >= sizeof(path))
+                continue;
+            if(needs_scan(dm, path) && enqueue(dm, path) < 0)
+                break;
+        }
+        closedir(dir);
+    }
+}
+
+void send_stats(struct daemon *dm, int client) {
+    // Writes the queue and latency figures to a client of the stats socket
+    char buf[512];
+    int n, finished;
+
+    pthread_mutex_lock(&dm->lock);
+    finished = dm->done + dm->failed;
+    n = snprintf(buf, sizeof(buf),
+                 "queued %i\nactive %i\ndone %i\nfailed %i\ndeferred %i\nlatency_avg_ms %.1f\nlatency_max_ms %.1f\n",
+                 dm->count, dm->active, dm->done, dm->failed, dm->deferred,
+                 finished ? 1000 * dm->total_latency / finished : 0.0, 1000 * dm->max_latency);
+    pthread_mutex_unlock(&dm->lock);
+    if(write(client, buf, n) < 0)
+        ;  // the client went away
+}
+
+int open_stats_socket(char *path) {
+    struct sockaddr_un addr;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if(fd < 0)
+        return -1;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    unlink(path);
+    if(bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(fd, 8) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int run_daemon(struct daemon_config *config) {
+    // Watches the directories for images that have been written (or moved in) and scans
+    // them on a pool of config->workers threads, through a queue of config->queue_size.
+    // Runs until SIGINT or SIGTERM.
+    struct daemon dm;
+    struct pollfd fds[3];
+    pthread_t *workers = malloc(config->workers * sizeof(pthread_t));
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    char path[MAXPATHLEN + 1];
+    int *wds = malloc(config->nwatch * sizeof(int));
+    int inotify_fd, sock = -1, client, i, w;
+    ssize_t len;
+    struct sigaction sa;
+    sigset_t signals, old;
+
+    memset(&dm, 0, sizeof(dm));
+    dm.config = config;
+    dm.queue = calloc(config->queue_size, sizeof(struct job));
+    pthread_mutex_init(&dm.lock, NULL);
+    pthread_cond_init(&dm.not_empty, NULL);
+    len = readlink("/proc/self/exe", dm.self, MAXPATHLEN);
+    if(len <= 0 || pipe2(dm.done_pipe, O_CLOEXEC | O_NONBLOCK) < 0) {
+        fprintf(stderr, "Cannot start daemon: %s\n", strerror(errno));
+        return 1;
+    }
+    dm.self[len] = '\0';
+    if(mkdir(config->outbox, 0755) < 0 && errno != EEXIST) {
+        fprintf(stderr, "Cannot create %s: %s\n", config->outbox, strerror(errno));
+        return 1;
+    }
+
+    inotify_fd = inotify_init1(IN_CLOEXEC);
+    for(w = 0; w < config->nwatch; w++) {
+        // only complete images: closed after writing, or moved in whole
+        wds[w] = inotify_add_watch(inotify_fd, config->watch[w], IN_CLOSE_WRITE | IN_MOVED_TO);
+        if(wds[w] < 0) {
+            fprintf(stderr, "Cannot watch %s: %s\n", config->watch[w], strerror(errno));
+            return 1;
+        }
+    }
+    if(config->socket && (sock = open_stats_socket(config->socket)) < 0) {
+        fprintf(stderr, "Cannot listen on %s: %s\n", config->socket, strerror(errno));
+        return 1;
+    }
+
+    wake_fd = dm.done_pipe[1];
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stop_daemon;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    // the workers block the signals, so they are handled on the main thread, which is
+    // the one that has to wake up and stop
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, &old);
+    for(i = 0; i < config->workers; i++)
+        pthread_create(&workers[i], NULL, daemon_worker, &dm);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    rescan_dirs(&dm);
+
+    fds[0].fd = inotify_fd;
+    fds[1].fd = dm.done_pipe[0];
+    fds[2].fd = sock;
+    for(i = 0; i < 3; i++)
+        fds[i].events = POLLIN;
+    while(!stopping) {
+        if(poll(fds, sock >= 0 ? 3 : 2, -1) < 0)
+            continue;  // a signal
+        if(fds[0].revents & POLLIN) {
+            len = read(inotify_fd, buf, sizeof(buf));
+            for(i = 0; i < len; ) {
+                struct inotify_event *ev = (struct inotify_event *) (buf + i);
+                if(ev->mask & IN_Q_OVERFLOW) {
+                    pthread_mutex_lock(&dm.lock);
+                    dm.overflowed = 1;  // events were lost, so look at the directories again
+                    pthread_mutex_unlock(&dm.lock);
+                }
+                for(w = 0; w < config->nwatch && ev->len; w++) {
+                    if(wds[w] == ev->wd && ev->name[0] != '.'
+                       && snprintf(path, sizeof(path), "%s/%s", config->watch[w], ev->name) < sizeof(path))
+                        enqueue(&dm, path);
+                }
+                i += sizeof(struct inotify_event) + ev->len;
+            }
+        }
+        if(fds[1].revents & POLLIN) {
+            if(read(dm.done_pipe[0], buf, sizeof(buf)) < 0)
+                ;
+        }
+        if(sock >= 0 && (fds[2].revents & POLLIN) && (client = accept(sock, NULL, NULL)) >= 0) {
+            send_stats(&dm, client);
+            close(client);
+        }
+        // backpressure: what didn't fit in the queue is still in the directories
+        pthread_mutex_lock(&dm.lock);
+        i = dm.overflowed && dm.count < config->queue_size;
+        pthread_mutex_unlock(&dm.lock);
+        if(i)
+            rescan_dirs(&dm);
+    }
+
+    pthread_mutex_lock(&dm.lock);
+    pthread_cond_broadcast(&dm.not_empty);
+    pthread_mutex_unlock(&dm.lock);
+    for(i = 0; i < config->workers; i++)
+        pthread_join(workers[i], NULL);
+    if(sock >= 0) {
+        close(sock);
+        unlink(config->socket);
+    }
+    close(inotify_fd);
+    wake_fd = -1;
+    close(dm.done_pipe[0]);
+    close(dm.done_pipe[1]);
+    printf("Daemon: %i scanned, %i failed, %i deferred\n", dm.done, dm.failed, dm.deferred);
+    free(dm.queue);
+    free(workers);
+    free(wds);
+    return 0;
+}
@@ -0,0 +1,15 @@
+/* By: Bagus Maulana */
+
+/* prototypes for functions in daemon.c */
+
+struct daemon_config {
+    char **watch;       // directories to watch for new images
+    int nwatch;
+    char *outbox;       // where the reports go, as <image name>.txt
+    char *socket;       // UNIX socket for stats, or NULL
+    int workers;        // scans run at once
+    int queue_size;     // images waiting at most; the rest wait in their directory
+    long timeout;       // milliseconds a scan may take before it gives up, or 0
+};
+
+int run_daemon(struct daemon_config *config);
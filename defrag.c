@@ -0,0 +1,254 @@
+/* By: Bagus Maulana */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "bootsect.h"
+#include "bpb.h"
+#include "direntry.h"
+#include "fat.h"
+#include "dos.h"
+#include "dos_scandisk.h"
+#include "defrag.h"
+
+#define OWNER_FREE -1    // cluster is free
+#define OWNER_PINNED -2  // cluster is in use but must not be moved (dirs, lost files, bad clusters...)
+
+struct candidate {
+    int file;
+    int clusters;
+};
+
+int get_chain(uint16_t cluster, uint16_t *chain, int max, uint8_t *image_buf, struct bpb33 *bpb) {
+    // Similar to follow_non_dir, but records the clusters of the file in chain.
+    // Returns -1 if the chain doesn't end in an EOF marker (broken, looped or out of range).
+    int n = 0;
+    while(n < max) {
+        if(is_end_of_file(cluster))
+            return n;
+        if(cluster < CLUST_FIRST || cluster >= max)
+            return -1;
+
+        chain[n++] = cluster;
+        cluster = get_fat_entry(cluster, image_buf, bpb);  //get next cluster in file
+    }
+    return -1;
+}
+
+int is_contiguous(uint16_t *chain, int n) {
+    int k;
+    for(k = 1; k < n; k++) {
+        if(chain[k] != chain[0] + k)
+            return 0;
+    }
+    return 1;
+}
+
+int window_score(int f, uint16_t start, uint16_t *chain, int n, int *owner, int nclust) {
+    // Returns the number of clusters of file f that are already in place if it were
+    // laid out from cluster start onwards, or -1 if the window isn't free.
+    int k, score = 0;
+    if(start < CLUST_FIRST || start + n > nclust)
+        return -1;
+
+    for(k = 0; k < n; k++) {
+        if(owner[start + k] != OWNER_FREE && owner[start + k] != f)
+            return -1;
+    }
+    for(k = 0; k < n; k++) {
+        if(chain[k] == start + k)
+            score++;
+    }
+    return score;
+}
+
+int compare_candidates(const void *a, const void *b) {
+    // largest files first, they are the hardest to place
+    return ((struct candidate *) b)->clusters - ((struct candidate *) a)->clusters;
+}
+
+void plan_defrag(struct defrag_plan *plan, struct file *files, int filectr, uint8_t *image_buf, struct bpb33 *bpb) {
+    // Works out where each fragmented file should go so that it becomes contiguous.
+    // For each file we try every start cluster that would leave at least one of its
+    // clusters where it already is, and keep the one that leaves the most in place.
+    int nclust = num_clusters(bpb);
+    int *owner = malloc(nclust * sizeof(int));
+    int *crossed = calloc(filectr, sizeof(int));
+    int *len = calloc(filectr, sizeof(int));
+    uint16_t **chains = calloc(filectr, sizeof(uint16_t *));
+    uint16_t *chain = malloc(nclust * sizeof(uint16_t));
+    struct candidate *cands = malloc(filectr * sizeof(struct candidate));
+    int ncands = 0, f, k, c;
+
+    plan->relocs = malloc(filectr * sizeof(struct relocation));
+    plan->nrelocs = 0;
+    plan->moves = 0;
+    plan->stuck = 0;
+
+    for(c = 0; c < nclust; c++)
+        owner[c] = get_fat_entry(c, image_buf, bpb) == CLUST_FREE ? OWNER_FREE : OWNER_PINNED;
+
+    // Claim the clusters of every file. Files sharing a cluster (cross-linked) are left alone.
+    // So are files whose chain is broken: their clusters stay pinned, and any file sharing
+    // one of them runs into the same break.
+    for(f = 0; f < filectr; f++) {
+        int n = get_chain(files[f].start_cluster, chain, nclust, image_buf, bpb);
+        if(n < 0)
+            printf("Defrag: %s.%s has a broken cluster chain, left where it is\n", files[f].name, files[f].ext);
+        if(n <= 0)
+            continue;
+
+        chains[f] = malloc(n * sizeof(uint16_t));
+        memcpy(chains[f], chain, n * sizeof(uint16_t));
+        len[f] = n;
+        for(k = 0; k < n; k++) {
+            if(owner[chain[k]] >= 0)
+                crossed[owner[chain[k]]] = crossed[f] = 1;
+            owner[chain[k]] = f;
+        }
+    }
+    for(f = 0; f < filectr; f++) {
+        if(!len[f] || (!crossed[f] && !is_contiguous(chains[f], len[f])))
+            continue;
+        for(k = 0; k < len[f]; k++)
+            owner[chains[f][k]] = OWNER_PINNED;
+        len[f] = 0;
+    }
+    for(f = 0; f < filectr; f++) {
+        if(len[f]) {
+            cands[ncands].file = f;
+            cands[ncands].clusters = len[f];
+            ncands++;
+        }
+    }
+    qsort(cands, ncands, sizeof(struct candidate), compare_candidates);
+
+    for(c = 0; c < ncands; c++) {
+        int n = cands[c].clusters, best = -1, best_score = -1, score, run = 0;
+        uint16_t *fchain;
+        f = cands[c].file;
+        fchain = chains[f];
+
+        for(k = 0; k < n; k++) {
+            if(k > 0 && fchain[k] - k == fchain[k - 1] - (k - 1))
+                continue;  // same start as the previous cluster
+            score = window_score(f, fchain[k] - k, fchain, n, owner, nclust);
+            if(score > best_score) {
+                best = fchain[k] - k;
+                best_score = score;
+            }
+        }
+        if(best < 0) {
+            // nothing overlaps with where the file is now, so take the first window that fits
+            for(k = CLUST_FIRST; k < nclust; k++) {
+                run = (owner[k] == OWNER_FREE || owner[k] == f) ? run + 1 : 0;
+                if(run == n) {
+                    best = k - n + 1;
+                    best_score = window_score(f, best, fchain, n, owner, nclust);
+                    break;
+                }
+            }
+        }
+        if(best < 0) {
+            printf("Defrag: no room to make %s.%s contiguous\n", files[f].name, files[f].ext);
+            plan->stuck++;
+            continue;
+        }
+
+        for(k = 0; k < n; k++)
+            owner[fchain[k]] = OWNER_FREE;
+        for(k = 0; k < n; k++)
+            owner[best + k] = f;
+
+        plan->relocs[plan->nrelocs].file = f;
+        plan->relocs[plan->nrelocs].target = best;
+        plan->relocs[plan->nrelocs].clusters = n;
+        plan->relocs[plan->nrelocs].moves = n - best_score;
+        plan->moves += n - best_score;
+        plan->nrelocs++;
+    }
+
+    for(f = 0; f < filectr; f++)
+        free(chains[f]);
+    free(chains);
+    free(chain);
+    free(cands);
+    free(len);
+    free(crossed);
+    free(owner);
+}
+
+void print_defrag_plan(struct defrag_plan *plan, struct file *files) {
+    int r;
+    for(r = 0; r < plan->nrelocs; r++) {
+        struct file *f = &files[plan->relocs[r].file];
+        printf("Defrag: %s.%s %i clusters -> %i-%i (%i moved)\n", f->name, f->ext, plan->relocs[r].clusters,
+               plan->relocs[r].target, plan->relocs[r].target + plan->relocs[r].clusters - 1, plan->relocs[r].moves);
+    }
+    printf("Defrag: %i files relocated, %i cluster moves, %i files left fragmented\n",
+           plan->nrelocs, plan->moves, plan->stuck);
+}
+
+void execute_defrag(struct defrag_plan *plan, struct file *files, uint8_t *image_buf, struct bpb33 *bpb) {
+    // Carries out the plan in order. Each file is gathered into a buffer and written to
+    // its new extent in one sequential copy. The FAT changes are collected in memory and
+    // the FAT and the directory entries are only rewritten once everything has moved.
+    // If a chain no longer has the length it was planned with, nothing is moved at all:
+    // the plan handed out that file's clusters to the others.
+    int nclust = num_clusters(bpb);
+    int cluster_size = bpb->bpbBytesPerSec * bpb->bpbSecPerClust;
+    uint16_t *fat = malloc(nclust * sizeof(uint16_t));
+    uint16_t *chain = malloc(nclust * sizeof(uint16_t));
+    int r, k, c;
+
+    for(c = 0; c < nclust; c++)
+        fat[c] = get_fat_entry(c, image_buf, bpb);
+
+    for(r = 0; r < plan->nrelocs; r++) {
+        struct file *f = &files[plan->relocs[r].file];
+        if(get_chain(f->start_cluster, chain, nclust, image_buf, bpb) != plan->relocs[r].clusters) {
+            printf("Defrag: the chain of %s.%s changed since the plan, nothing moved\n", f->name, f->ext);
+            free(chain);
+            free(fat);
+            return;
+        }
+    }
+
+    for(r = 0; r < plan->nrelocs; r++) {
+        struct file *f = &files[plan->relocs[r].file];
+        uint16_t target = plan->relocs[r].target;
+        int n = plan->relocs[r].clusters;
+        uint8_t *buf = malloc(n * cluster_size);
+
+        get_chain(f->start_cluster, chain, nclust, image_buf, bpb);
+        for(k = 0; k < n; k++) {
+            memcpy(buf + k * cluster_size, cluster_to_addr(chain[k], image_buf, bpb), cluster_size);
+            fat[chain[k]] = CLUST_FREE;
+        }
+        memcpy(cluster_to_addr(target, image_buf, bpb), buf, n * cluster_size);
+        for(k = 0; k < n; k++)
+            fat[target + k] = k == n - 1 ? (FAT12_MASK & CLUST_EOFE) : target + k + 1;
+
+        free(buf);
+    }
+
+    // one FAT rewrite...
+    for(c = CLUST_FIRST; c < nclust; c++) {
+        if(fat[c] != get_fat_entry(c, image_buf, bpb))
+            set_fat_entry(c, fat[c], image_buf, bpb);
+    }
+    mirror_fat(image_buf, bpb);
+
+    // ...and one directory rewrite
+    for(r = 0; r < plan->nrelocs; r++) {
+        struct file *f = &files[plan->relocs[r].file];
+        f->start_cluster = plan->relocs[r].target;
+        putushort(f->de->deStartCluster, f->start_cluster);
+    }
+
+    free(chain);
+    free(fat);
+}
@@ -0,0 +1,21 @@
+/* By: Bagus Maulana */
+
+/* prototypes for functions in defrag.c */
+
+struct relocation {
+    int file;         // index into the files array
+    uint16_t target;  // first cluster of the file's new contiguous extent
+    int clusters;     // length of its chain when the plan was made
+    int moves;        // number of clusters that change position
+};
+
+struct defrag_plan {
+    struct relocation *relocs;
+    int nrelocs;
+    int moves;       // total cluster moves over all relocations
+    int stuck;       // fragmented files that couldn't be placed
+};
+
+void plan_defrag(struct defrag_plan *plan, struct file *files, int filectr, uint8_t *image_buf, struct bpb33 *bpb);
+void print_defrag_plan(struct defrag_plan *plan, struct file *files);
+void execute_defrag(struct defrag_plan *plan, struct file *files, uint8_t *image_buf, struct bpb33 *bpb);
@@ -0,0 +1,590 @@
+/* By: Bagus Maulana */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "bootsect.h"
+#include "bpb.h"
+#include "direntry.h"
+#include "fat.h"
+#include "dos.h"
+#include "dos_scandisk.h"
+#include "lfn.h"
+#include "dirwalk.h"
+#include "diff.h"
+
+#define FIEMAP_BATCH 256
+#define CHANGED_DATA 1  // the cluster's contents differ
+#define CHANGED_FAT 2   // its FAT entry differs
+#define HEAD_WANTED 1   // a changed chain starts at the cluster
+#define HEAD_FOUND 2    // and an entry starting there has been found
+#define DIFF_ADDED 1
+#define DIFF_REMOVED 2
+#define DIFF_MODIFIED 3
+
+int sector_differs(const uint8_t *a, const uint8_t *b, int len) {
+    // Compares a sector 64 bytes at a time, only branching once per 64 bytes
+#ifdef __SSE2__
+    int i;
+    for(i = 0; i + 64 <= len; i += 64) {
+        __m128i x = _mm_xor_si128(_mm_loadu_si128((__m128i *) (a + i)), _mm_loadu_si128((__m128i *) (b + i)));
+        x = _mm_or_si128(x, _mm_xor_si128(_mm_loadu_si128((__m128i *) (a + i + 16)), _mm_loadu_si128((__m128i *) (b + i + 16))));
+        x = _mm_or_si128(x, _mm_xor_si128(_mm_loadu_si128((__m128i *) (a + i + 32)), _mm_loadu_si128((__m128i *) (b + i + 32))));
+        x = _mm_or_si128(x, _mm_xor_si128(_mm_loadu_si128((__m128i *) (a + i + 48)), _mm_loadu_si128((__m128i *) (b + i + 48))));
+        if(_mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_setzero_si128())) != 0xffff)
+            return 1;
+    }
+    return i < len && memcmp(a + i, b + i, len - i) != 0;
+#else
+    return memcmp(a, b, len) != 0;
+#endif
+}
+
+int add_extent(struct extent **list, int n, off_t start, off_t end) {
+    if(start >= end)
+        return n;
+    if(n == 0 || (n & (n - 1)) == 0)
+        *list = realloc(*list, (n ? 2 * n : 1) * sizeof(struct extent));
+    (*list)[n].start = start;
+    (*list)[n].end = end;
+    return n + 1;
+}
+
+int physical_extents(int fd, struct fiemap_extent **out) {
+    // The file's extents as the filesystem stores them, or 0 if it won't say. Extents
+    // whose blocks may not be final (delayed allocation, inline or encoded data) are
+    // left out, so they are always compared.
+    struct fiemap *fm = calloc(1, sizeof(struct fiemap) + FIEMAP_BATCH * sizeof(struct fiemap_extent));
+    uint32_t unsafe = FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DELALLOC | FIEMAP_EXTENT_ENCODED
+        | FIEMAP_EXTENT_DATA_INLINE | FIEMAP_EXTENT_DATA_TAIL | FIEMAP_EXTENT_NOT_ALIGNED;
+    uint64_t pos = 0;
+    int i, n = 0, last = 0;
+
+    *out = NULL;
+    while(!last) {
+        memset(fm, 0, sizeof(struct fiemap));
+        fm->fm_start = pos;
+        fm->fm_length = FIEMAP_MAX_OFFSET - pos;
+        fm->fm_flags = FIEMAP_FLAG_SYNC;
+        fm->fm_extent_count = FIEMAP_BATCH;
+        if(ioctl(fd, FS_IOC_FIEMAP, fm) < 0 || fm->fm_mapped_extents == 0)
+            break;
+        for(i = 0; i < (int) fm->fm_mapped_extents; i++) {
+            struct fiemap_extent *fe = &fm->fm_extents[i];
+            last = fe->fe_flags & FIEMAP_EXTENT_LAST;
+            pos = fe->fe_logical + fe->fe_length;
+            if(fe->fe_flags & unsafe)
+                continue;
+            if(n == 0 || (n & (n - 1)) == 0)
+                *out = realloc(*out, (n ? 2 * n : 1) * sizeof(struct fiemap_extent));
+            (*out)[n++] = *fe;
+        }
+    }
+    free(fm);
+    return n;
+}
+
+int cmp_extent(const void *a, const void *b) {
+    const struct extent *x = a, *y = b;
+    return x->start < y->start ? -1 : x->start > y->start;
+}
+
+int same_ranges(int fda, int fdb, off_t size, struct extent **same) {
+    // The byte ranges that must be the same in both images without reading them: those
+    // the two files share on disk (a reflinked snapshot), and those that are holes in
+    // both. Returns them sorted and merged.
+    struct fiemap_extent *ea, *eb;
+    struct hole_map *ha = build_hole_map(fda), *hb = build_hole_map(fdb);
+    struct extent *data = NULL;
+    off_t pos, start, end;
+    int na = physical_extents(fda, &ea), nb = physical_extents(fdb, &eb);
+    int i, j, n = 0, ndata = 0;
+
+    // both lists are sorted by offset, so one merge finds the overlapping pairs
+    for(i = 0, j = 0; i < na && j < nb; ) {
+        start = ea[i].fe_logical > eb[j].fe_logical ? ea[i].fe_logical : eb[j].fe_logical;
+        end = ea[i].fe_logical + ea[i].fe_length < eb[j].fe_logical + eb[j].fe_length
+            ? ea[i].fe_logical + ea[i].fe_length : eb[j].fe_logical + eb[j].fe_length;
+        if(start < end && ea[i].fe_physical - ea[i].fe_logical == eb[j].fe_physical - eb[j].fe_logical)
+            n = add_extent(same, n, start, end < size ? end : size);
+        if(ea[i].fe_logical + ea[i].fe_length < eb[j].fe_logical + eb[j].fe_length)
+            i++;
+        else
+            j++;
+    }
+    free(ea);
+    free(eb);
+
+    // what isn't data in either file reads back as zeros in both
+    for(i = 0; i < ha->n; i++)
+        ndata = add_extent(&data, ndata, ha->data[i].start, ha->data[i].end);
+    for(i = 0; i < hb->n; i++)
+        ndata = add_extent(&data, ndata, hb->data[i].start, hb->data[i].end);
+    if(ndata)
+        qsort(data, ndata, sizeof(struct extent), cmp_extent);
+    for(i = 0, pos = 0; i < ndata; i++) {
+        n = add_extent(same, n, pos, data[i].start < size ? data[i].start : size);
+        if(data[i].end > pos)
+            pos = data[i].end;
+    }
+    n = add_extent(same, n, pos, size);
+    free(data);
+    free_hole_map(ha);
+    free_hole_map(hb);
+
+    if(n)
+        qsort(*same, n, sizeof(struct extent), cmp_extent);
+    for(i = 0, j = 0; i < n; i++) {
+        if(j && (*same)[i].start <= (*same)[j - 1].end) {
+            if((*same)[i].end > (*same)[j - 1].end)
+                (*same)[j - 1].end = (*same)[i].end;
+        } else {
+            (*same)[j++] = (*same)[i];
+        }
+    }
+    return j;
+}
+
+// an entry found while tracing the changes through one image
+struct diff_entry {
+    char *path;
+    struct direntry *de;
+};
+
+// one image's side of a diff: the chains holding the changed clusters, and the entries
+// found for them in its directory tree
+struct diff_side {
+    uint8_t *image_buf;
+    struct bpb33 *bpb;
+    int nclust;
+    uint16_t *prev;     // per cluster: a cluster whose FAT entry leads to it (or, once traced, its chain's head), or 0
+    uint8_t *heads;     // per cluster: HEAD_WANTED if a changed chain starts here, HEAD_FOUND once an entry does
+    int remaining;      // heads not found yet
+    int tracing;        // matching entries to heads, not just listing
+    struct diff_entry *found;   // the entries starting a changed chain
+    struct diff_entry *listed;  // the entries of the directories whose contents changed
+    int nfound, nlisted;
+};
+
+// a directory being traced
+struct diff_dir {
+    struct diff_side *side;
+    char *path;
+    int list;     // record all of its entries, not just those starting a changed chain
+    int recurse;  // when listing: list its subdirectories too
+    int depth;
+};
+
+// a path being looked up, one directory at a time
+struct diff_lookup {
+    struct diff_side *side;
+    const char *path;
+    int len;  // how much of path the entry being looked for is
+    char dir[MAXPATHLEN + 1];
+    struct direntry *de;
+};
+
+// a line of the report
+struct diff_change {
+    char *path;
+    int kind;
+    int dir;
+};
+
+int add_diff_entry(struct diff_entry **list, int n, char *path, struct direntry *de) {
+    if(n == 0 || (n & (n - 1)) == 0)
+        *list = realloc(*list, (n ? 2 * n : 1) * sizeof(struct diff_entry));
+    (*list)[n].path = strdup(path);
+    (*list)[n].de = de;
+    return n + 1;
+}
+
+void free_diff_entries(struct diff_entry *list, int n) {
+    int i;
+    for(i = 0; i < n; i++)
+        free(list[i].path);
+    free(list);
+}
+
+int add_change(struct diff_change **list, int n, char *path, int kind, struct direntry *de) {
+    if(n == 0 || (n & (n - 1)) == 0)
+        *list = realloc(*list, (n ? 2 * n : 1) * sizeof(struct diff_change));
+    (*list)[n].path = strdup(path);
+    (*list)[n].kind = kind;
+    (*list)[n].dir = (de->deAttributes & ATTR_DIRECTORY) != 0;
+    return n + 1;
+}
+
+int cmp_diff_entry(const void *a, const void *b) {
+    return strcmp(((const struct diff_entry *) a)->path, ((const struct diff_entry *) b)->path);
+}
+
+int cmp_diff_change(const void *a, const void *b) {
+    const struct diff_change *x = a, *y = b;
+    int order = strcmp(x->path, y->path);
+    return order ? order : x->kind - y->kind;
+}
+
+uint16_t chain_head(struct diff_side *side, uint16_t cluster) {
+    // Walks back through the FAT to the first cluster of cluster's chain, then points
+    // every cluster on the way straight at it, so the next walk from the chain is short
+    uint16_t head = cluster, next;
+    int steps;
+    for(steps = 0; side->prev[head] && steps < side->nclust; steps++)
+        head = side->prev[head];
+    side->prev[head] = 0;  // if the chain loops, it starts here now
+    while(cluster != head && side->prev[cluster] && steps-- > 0) {
+        next = side->prev[cluster];
+        side->prev[cluster] = head;
+        cluster = next;
+    }
+    return head;
+}
+
+int trace_entry(struct direntry *de, struct dir_pos *pos, void *arg) {
+    // Called for each entry of a directory being traced: records it if it starts a
+    // changed chain or its directory is being listed, and goes into subdirectories while
+    // there are chains left to find (or the subdirectory itself changed)
+    struct diff_dir *dd = arg, sub;
+    struct diff_side *side = dd->side;
+    struct dir_visitor v = {NULL, trace_entry, &sub, 0, NULL};
+    uint16_t start = getushort(de->deStartCluster);
+    int valid = start >= CLUST_FIRST && start < side->nclust;
+    int wanted = side->tracing && valid && side->heads[start];  // another entry may share a chain
+    char path[MAXPATHLEN + 1];
+
+    if(!dd->list && !side->remaining)
+        return 1;  // everything has been found
+    entry_path(path, sizeof(path), dd->path, de, &pos->lfn, side->image_buf, side->bpb);
+    if(dd->list)
+        side->nlisted = add_diff_entry(&side->listed, side->nlisted, path, de);
+    if(wanted) {
+        side->nfound = add_diff_entry(&side->found, side->nfound, path, de);
+        side->remaining -= side->heads[start] == HEAD_WANTED;
+        side->heads[start] = HEAD_FOUND;
+    }
+    if((de->deAttributes & ATTR_DIRECTORY) && valid && (side->remaining || wanted || dd->recurse)) {
+        sub = *dd;
+        sub.path = path;
+        sub.list = wanted || dd->recurse;
+        sub.depth++;
+        for_each_entry(start, sub.depth, &v, side->image_buf, side->bpb);
+    }
+    return 0;
+}
+
+void trace_changes(struct diff_side *side, uint8_t *changed, int root) {
+    // Finds the entries that own the changed clusters: walks back through the FAT from
+    // each to the head of its chain, then goes through the directory tree only until
+    // every head has an entry (or there is nowhere left to look). The root directory's
+    // entries are all listed if root is set.
+    struct diff_dir top = {side, "", root, 0, 0};
+    struct dir_visitor v = {NULL, trace_entry, &top, 0, NULL};
+    uint16_t next, head;
+    int c;
+
+    side->prev = calloc(side->nclust, sizeof(uint16_t));
+    side->heads = calloc(side->nclust, 1);
+    for(c = CLUST_FIRST; c < side->nclust; c++) {
+        next = get_fat_entry(c, side->image_buf, side->bpb);
+        if(next >= CLUST_FIRST && next < side->nclust && next != c && !side->prev[next])
+            side->prev[next] = c;
+    }
+    for(c = CLUST_FIRST; c < side->nclust; c++) {
+        if(!changed[c])
+            continue;
+        head = chain_head(side, c);
+        // a free cluster that nothing leads to is in no file, so there is nothing to find
+        if(side->heads[head] || get_fat_entry(head, side->image_buf, side->bpb) == CLUST_FREE)
+            continue;
+        side->heads[head] = HEAD_WANTED;
+        side->remaining++;
+    }
+    side->tracing = 1;
+    if(root || side->remaining)
+        for_each_entry(MSDOSFSROOT, 0, &v, side->image_buf, side->bpb);
+    side->tracing = 0;  // what wasn't found is in no file; later walks only list
+    side->remaining = 0;
+}
+
+int match_entry(struct direntry *de, struct dir_pos *pos, void *arg) {
+    struct diff_lookup *dl = arg;
+    char path[MAXPATHLEN + 1];
+    entry_path(path, sizeof(path), dl->dir, de, &pos->lfn, dl->side->image_buf, dl->side->bpb);
+    if((int) strlen(path) != dl->len || strncmp(path, dl->path, dl->len) != 0)
+        return 0;
+    dl->de = de;
+    return 1;
+}
+
+struct direntry *find_entry(struct diff_side *side, const char *path) {
+    // Looks path up in side's image one directory at a time, or NULL if it isn't there
+    struct diff_lookup dl;
+    struct dir_visitor v = {NULL, match_entry, &dl, 0, NULL};
+    uint16_t cluster = MSDOSFSROOT;
+    const char *slash = path;
+
+    dl.side = side;
+    dl.path = path;
+    dl.dir[0] = '\0';
+    while(1) {
+        slash = strchr(slash + 1, '/');
+        dl.len = slash ? slash - path : (int) strlen(path);
+        if(!for_each_entry(cluster, 0, &v, side->image_buf, side->bpb))
+            return NULL;
+        if(!slash)
+            return dl.de;
+        cluster = getushort(dl.de->deStartCluster);
+        if(!(dl.de->deAttributes & ATTR_DIRECTORY) || cluster < CLUST_FIRST || cluster >= side->nclust)
+            return NULL;
+        memcpy(dl.dir, path, dl.len);
+        dl.dir[dl.len] = '\0';
+    }
+}
+
+void list_dir(struct diff_side *side, char *path, int recurse) {
+    // Adds the entries of the directory at path to side->listed (and, if recurse is set,
+    // everything under it); nothing if side's image has no directory there
+    struct diff_dir dd = {side, path, 1, recurse, 1};
+    struct dir_visitor v = {NULL, trace_entry, &dd, 0, NULL};
+    struct direntry *de = find_entry(side, path);
+    uint16_t start;
+
+    if(!de || !(de->deAttributes & ATTR_DIRECTORY))
+        return;
+    start = getushort(de->deStartCluster);
+    if(start >= CLUST_FIRST && start < side->nclust)
+        for_each_entry(start, 1, &v, side->image_buf, side->bpb);
+}
+
+int list_tree(struct diff_side *side, char *path, int kind, struct diff_change **changes, int n) {
+    // Reports everything under the directory at path as added or removed with it
+    struct diff_side tree = *side;
+    int i;
+    tree.listed = NULL;
+    tree.nlisted = 0;
+    list_dir(&tree, path, 1);
+    for(i = 0; i < tree.nlisted; i++)
+        n = add_change(changes, n, tree.listed[i].path, kind, tree.listed[i].de);
+    free_diff_entries(tree.listed, tree.nlisted);
+    return n;
+}
+
+void list_changed_dirs(struct diff_side *from, struct diff_side *to) {
+    // A directory whose clusters changed in from's image is listed from to's image too,
+    // so that their entries can be matched up
+    struct diff_entry *found;
+    int i;
+    for(i = 0; i < from->nfound; i++) {
+        if(!(from->found[i].de->deAttributes & ATTR_DIRECTORY))
+            continue;
+        found = to->nfound ? bsearch(&from->found[i], to->found, to->nfound, sizeof(struct diff_entry), cmp_diff_entry) : NULL;
+        if(!found || !(found->de->deAttributes & ATTR_DIRECTORY))
+            list_dir(to, from->found[i].path, 0);
+    }
+}
+
+int changed_files(struct diff_side *from, struct diff_side *to, int missing, struct diff_change **changes, int n) {
+    // A file one of whose clusters changed is modified if it is in the other image too,
+    // or else missing (added or removed)
+    struct direntry *de;
+    int i;
+    for(i = 0; i < from->nfound; i++) {
+        if(from->found[i].de->deAttributes & ATTR_DIRECTORY)
+            continue;
+        de = find_entry(to, from->found[i].path);
+        if(!de)
+            n = add_change(changes, n, from->found[i].path, missing, from->found[i].de);
+        else if(!(de->deAttributes & ATTR_DIRECTORY))
+            n = add_change(changes, n, from->found[i].path, DIFF_MODIFIED, de);
+    }
+    return n;
+}
+
+int diff_images(char *namea, char *nameb) {
+    // Reports what changed from namea to nameb, two images of the same volume. The
+    // sectors are compared first (skipping what the two files share on disk or both
+    // leave as holes), then the FAT entries in the FAT sectors that differ are compared,
+    // and the changed clusters are traced back through each image's FAT to the files
+    // that own them.
+    // Returns 0 if the images are the same, 2 if they differ, 1 if they can't be compared.
+    int fda, fdb, i, j, s, nsame, c, nclust;
+    uint8_t *imga = mmap_file_overlay(namea, &fda), *imgb = mmap_file_overlay(nameb, &fdb);
+    struct bpb33 *bpba = check_bootsector(imga), *bpbb = check_bootsector(imgb);
+    struct bpb33 *bpb = bpba;
+    struct extent *same = NULL;
+    uint32_t bps, nsectors, fat_start, root_start, data_start, skipped = 0;
+    int boot = 0, fat = 0, backup_fat = 0, root = 0, data = 0;
+    int allocated = 0, freed = 0, relinked = 0, contents = 0, unowned = 0;
+    int added = 0, removed = 0, modified = 0;
+    uint8_t *changed, *candidate;
+
+    if(bpba->bpbBytesPerSec != bpbb->bpbBytesPerSec || bpba->bpbSecPerClust != bpbb->bpbSecPerClust
+       || bpba->bpbResSectors != bpbb->bpbResSectors || bpba->bpbFATs != bpbb->bpbFATs
+       || bpba->bpbFATsecs != bpbb->bpbFATsecs || bpba->bpbRootDirEnts != bpbb->bpbRootDirEnts
+       || bpba->bpbSectors != bpbb->bpbSectors) {
+        fprintf(stderr, "%s and %s have different layouts, so they aren't the same volume\n", namea, nameb);
+        return 1;
+    }
+    bps = bpb->bpbBytesPerSec;
+    nsectors = bpb->bpbSectors;
+    fat_start = bpb->bpbResSectors;
+    root_start = fat_start + bpb->bpbFATs * bpb->bpbFATsecs;
+    data_start = root_start + bpb->bpbRootDirEnts * sizeof(struct direntry) / bps;
+    nclust = num_clusters(bpb);
+    changed = calloc(nclust, 1);
+    candidate = calloc(nclust, 1);
+
+    // compare every sector that isn't known to be the same, and sort the differences by area
+    nsame = same_ranges(fda, fdb, (off_t) nsectors * bps, &same);
+    for(s = 0, j = 0; s < (int) nsectors; s++) {
+        off_t off = (off_t) s * bps;
+        while(j < nsame && same[j].end < off + bps)
+            j++;
+        if(j < nsame && same[j].start <= off) {
+            skipped += same[j].end / bps - s;
+            s = same[j].end / bps - 1;
+            continue;
+        }
+        if(!sector_differs(imga + off, imgb + off, bps))
+            continue;
+        if((uint32_t) s < fat_start) {
+            boot++;
+        } else if((uint32_t) s < fat_start + bpb->bpbFATsecs) {
+            // the entries (partly) in this sector of the first FAT; an entry can straddle two
+            uint32_t first = (s - fat_start) * bps, last = first + bps;
+            fat++;
+            for(c = first ? first * 2 / 3 - 1 : 0; c <= (int) (last * 2 / 3) && c < nclust; c++)
+                if(c >= CLUST_FIRST)
+                    candidate[c] = 1;
+        } else if((uint32_t) s < root_start) {
+            backup_fat++;
+        } else if((uint32_t) s < data_start) {
+            root++;
+        } else {
+            c = (s - data_start) / bpb->bpbSecPerClust + CLUST_FIRST;
+            data++;
+            if(c < nclust)
+                changed[c] |= CHANGED_DATA;
+        }
+    }
+    free(same);
+    printf("Diff: %i of %u sectors differ (%i boot, %i FAT, %i backup FAT, %i root directory, %i data), %u skipped as shared or holes in both\n",
+           boot + fat + backup_fat + root + data, nsectors, boot, fat, backup_fat, root, data, skipped);
+
+    for(c = CLUST_FIRST; c < nclust; c++) {
+        uint16_t ea, eb;
+        if(!candidate[c])
+            continue;
+        ea = get_fat_entry(c, imga, bpba);
+        eb = get_fat_entry(c, imgb, bpbb);
+        if(ea == eb)
+            continue;
+        changed[c] |= CHANGED_FAT;
+        if(ea == CLUST_FREE)
+            allocated++;
+        else if(eb == CLUST_FREE)
+            freed++;
+        else
+            relinked++;
+    }
+    free(candidate);
+
+    if(fat || root || data) {
+        // Only now is it worth looking at the trees, and only at what changed: the
+        // entries owning the changed clusters, and the directories whose entries changed.
+        // A file in both images is modified if its entry or any of its clusters changed.
+        struct diff_side sa = {imga, bpba, nclust}, sb = {imgb, bpbb, nclust};
+        struct diff_change *changes = NULL;
+        int nchanges = 0;
+
+        trace_changes(&sa, changed, root);
+        trace_changes(&sb, changed, root);
+        if(sa.nfound)
+            qsort(sa.found, sa.nfound, sizeof(struct diff_entry), cmp_diff_entry);
+        if(sb.nfound)
+            qsort(sb.found, sb.nfound, sizeof(struct diff_entry), cmp_diff_entry);
+        list_changed_dirs(&sa, &sb);
+        list_changed_dirs(&sb, &sa);
+        if(sa.nlisted)
+            qsort(sa.listed, sa.nlisted, sizeof(struct diff_entry), cmp_diff_entry);
+        if(sb.nlisted)
+            qsort(sb.listed, sb.nlisted, sizeof(struct diff_entry), cmp_diff_entry);
+
+        for(i = 0, j = 0; i < sa.nlisted || j < sb.nlisted; ) {
+            int order = i == sa.nlisted ? 1 : j == sb.nlisted ? -1 : strcmp(sa.listed[i].path, sb.listed[j].path);
+            if(order < 0) {
+                nchanges = add_change(&changes, nchanges, sa.listed[i].path, DIFF_REMOVED, sa.listed[i].de);
+                if(sa.listed[i].de->deAttributes & ATTR_DIRECTORY)
+                    nchanges = list_tree(&sa, sa.listed[i].path, DIFF_REMOVED, &changes, nchanges);
+                i++;
+            } else if(order > 0) {
+                nchanges = add_change(&changes, nchanges, sb.listed[j].path, DIFF_ADDED, sb.listed[j].de);
+                if(sb.listed[j].de->deAttributes & ATTR_DIRECTORY)
+                    nchanges = list_tree(&sb, sb.listed[j].path, DIFF_ADDED, &changes, nchanges);
+                j++;
+            } else {
+                // a directory's own clusters change with its entries, which are reported as they are
+                if(!(sb.listed[j].de->deAttributes & ATTR_DIRECTORY)
+                   && memcmp(sa.listed[i].de, sb.listed[j].de, sizeof(struct direntry)) != 0)
+                    nchanges = add_change(&changes, nchanges, sb.listed[j].path, DIFF_MODIFIED, sb.listed[j].de);
+                i++;
+                j++;
+            }
+        }
+        nchanges = changed_files(&sa, &sb, DIFF_REMOVED, &changes, nchanges);
+        nchanges = changed_files(&sb, &sa, DIFF_ADDED, &changes, nchanges);
+
+        for(c = CLUST_FIRST; c < nclust; c++) {
+            if(!(changed[c] & CHANGED_DATA))
+                continue;
+            contents++;
+            unowned += sa.heads[chain_head(&sa, c)] != HEAD_FOUND && sb.heads[chain_head(&sb, c)] != HEAD_FOUND;
+        }
+
+        // the same change can be found both ways, through its directory and its clusters
+        if(nchanges)
+            qsort(changes, nchanges, sizeof(struct diff_change), cmp_diff_change);
+        for(i = 0; i < nchanges; i++) {
+            if(i == 0 || cmp_diff_change(&changes[i - 1], &changes[i]) != 0) {
+                if(changes[i].kind == DIFF_ADDED) {
+                    printf("Added: %s%s\n", changes[i].path, changes[i].dir ? "/" : "");
+                    added++;
+                } else if(changes[i].kind == DIFF_REMOVED) {
+                    printf("Removed: %s%s\n", changes[i].path, changes[i].dir ? "/" : "");
+                    removed++;
+                } else {
+                    printf("Modified: %s\n", changes[i].path);
+                    modified++;
+                }
+            }
+        }
+        for(i = 0; i < nchanges; i++)
+            free(changes[i].path);
+        free(changes);
+        free_diff_entries(sa.found, sa.nfound);
+        free_diff_entries(sb.found, sb.nfound);
+        free_diff_entries(sa.listed, sa.nlisted);
+        free_diff_entries(sb.listed, sb.nlisted);
+        free(sa.prev);
+        free(sb.prev);
+        free(sa.heads);
+        free(sb.heads);
+    }
+    printf("Files: %i added, %i removed, %i modified\n", added, removed, modified);
+    printf("Clusters: %i allocated, %i freed, %i relinked, %i with new contents (%i in no file)\n",
+           allocated, freed, relinked, contents, unowned);
+    free(changed);
+    close(fda);
+    close(fdb);
+    return boot || fat || backup_fat || root || data ? 2 : 0;
+}
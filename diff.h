@@ -0,0 +1,6 @@
+/* By: Bagus Maulana */
+
+/* prototypes for functions in diff.c */
+
+int sector_differs(const uint8_t *a, const uint8_t *b, int len);
+int diff_images(char *namea, char *nameb);
@@ -0,0 +1,98 @@
+/* By: Bagus Maulana */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "bootsect.h"
+#include "bpb.h"
+#include "direntry.h"
+#include "fat.h"
+#include "dos.h"
+#include "dos_scandisk.h"
+#include "lfn.h"
+#include "validate.h"
+#include "dirwalk.h"
+
+int for_each_entry(uint16_t cluster, int depth, struct dir_visitor *v, uint8_t *image_buf, struct bpb33 *bpb) {
+    // Goes through one directory's entries in order, the root or any other, and passes
+    // each file and subdirectory to v->entry with the long name slots that belong to it.
+    // Long name slots, "." and "..", deleted entries and volume labels aren't passed on
+    // (unless v->flags asks for the last two). The walk ends at the first empty entry, at
+    // the end of the directory's chain, or where the chain leaves the disk or loops.
+    // depth is how deep the caller's recursion is, so a directory loop can't go on for
+    // ever. Returns 1 if a callback stopped the walk, 0 if it reached the end.
+    int nclust = num_clusters(bpb), entries, d, steps = 0;
+    uint64_t suspect = 0;
+    struct lfn_run lfn = {0, 0, 0};
+    struct direntry *dirent;
+    struct dir_pos pos;
+    char name[9], extension[4];
+
+    if(depth > MAXPATHLEN / 2)
+        return 0;  // a directory loop
+    pos.dir_cluster = cluster;
+    pos.index = 0;
+    while(1) {
+        if(v->cluster && v->cluster(cluster, v->arg))
+            return 1;
+        // the root directory is one run of entries, other directories are a cluster at a time
+        pos.cluster = cluster;
+        dirent = (struct direntry *) cluster_to_addr(cluster, image_buf, bpb);
+        if(cluster == MSDOSFSROOT)
+            entries = bpb->bpbRootDirEnts;
+        else
+            entries = bpb->bpbBytesPerSec * bpb->bpbSecPerClust / sizeof(struct direntry);
+
+        for(d = 0; d < entries; d++, dirent++, pos.index++) {
+            if((v->flags & DIR_CHECK) && d % 64 == 0)
+                suspect = suspect_entries(dirent, entries - d < 64 ? entries - d : 64, bpb);
+            dirent_name(dirent, name, extension);
+            if(name[0] == SLOT_EMPTY) {
+                lfn_owner(&lfn, NULL, v->report);
+                return 0;
+            }
+
+            /* long name slots are only noted here, lfn.c decodes them when needed */
+            if(dirent->deAttributes == ATTR_WIN95 && ((uint8_t) name[0]) != SLOT_DELETED) {
+                lfn_slot(&lfn, dirent, pos.dir_cluster, pos.index, v->report);
+                continue;
+            }
+            pos.lfn = lfn_owner(&lfn, dirent, v->report);
+            if(((uint8_t) name[0]) == SLOT_DELETED && !(v->flags & DIR_DELETED))
+                continue;
+            if(strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+                continue;
+            if((dirent->deAttributes & ATTR_VOLUME) && !(v->flags & DIR_VOLUME))
+                continue;
+
+            pos.suspect = (suspect >> (d % 64)) & 1;
+            if(v->entry(dirent, &pos, v->arg))
+                return 1;
+        }
+        if(cluster == MSDOSFSROOT)
+            break;
+        cluster = get_fat_entry(cluster, image_buf, bpb);
+        if(is_end_of_file(cluster) || cluster < CLUST_FIRST || cluster >= nclust || ++steps >= nclust)
+            break;
+    }
+    lfn_owner(&lfn, NULL, v->report);
+    return 0;
+}
+
+void entry_path(char *buf, int len, char *path, struct direntry *de, struct lfn_run *lfn, uint8_t *image_buf, struct bpb33 *bpb) {
+    // The path of an entry in the directory at path: its long name if it has one that
+    // fits, or else its 8.3 name. Either way the last component is safe to create on
+    // the host: it can't hold a '/' or be "." or "..".
+    char name[9], extension[4], longname[4 * WIN_MAXLEN + 1];
+
+    if(lfn_name(lfn, de, longname, sizeof(longname), image_buf, bpb) && snprintf(buf, len, "%s/%s", path, longname) < len)
+        return;
+    dirent_name(de, name, extension);
+    if(((uint8_t) name[0]) == SLOT_E5)
+        name[0] = (char) SLOT_DELETED;
+    short_host_name(longname, sizeof(longname), name, extension);
+    snprintf(buf, len, "%s/%s", path, longname);
+}
@@ -0,0 +1,28 @@
+/* By: Bagus Maulana */
+
+/* prototypes for functions in dirwalk.c */
+
+#define DIR_DELETED 1  // also pass deleted entries on
+#define DIR_VOLUME 2   // also pass volume labels on (and, with DIR_DELETED, deleted long name slots)
+#define DIR_CHECK 4    // check the entries in bulk as they are read, setting pos->suspect
+
+// where for_each_entry is in a directory
+struct dir_pos {
+    uint16_t dir_cluster;  // the directory's first cluster, 0 for the root
+    uint16_t cluster;      // the cluster being read
+    int index;             // the entry's index in the whole directory
+    struct lfn_run lfn;    // the long name slots that belong to the entry
+    int suspect;           // with DIR_CHECK: the entry failed the bulk check, so needs entry_problems
+};
+
+// what a directory walk does; the callbacks return non-zero to stop it
+struct dir_visitor {
+    int (*cluster)(uint16_t cluster, void *arg);                        // each cluster as it is reached, or NULL
+    int (*entry)(struct direntry *de, struct dir_pos *pos, void *arg);  // each entry passed on
+    void *arg;
+    int flags;
+    FILE *report;  // where orphaned long name slots are reported, or NULL
+};
+
+int for_each_entry(uint16_t cluster, int depth, struct dir_visitor *v, uint8_t *image_buf, struct bpb33 *bpb);
+void entry_path(char *buf, int len, char *path, struct direntry *de, struct lfn_run *lfn, uint8_t *image_buf, struct bpb33 *bpb);
@@ -1,5 +1,7 @@
 /* 3005 Coursework 2, mjh, Nov 2005 */
 
+#define _GNU_SOURCE  /* for SEEK_DATA and SEEK_HOLE */
+
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -17,8 +19,10 @@
 #include "dos.h"
 
 
-/* memory map the FAT-12  disk image file */
-uint8_t *mmap_file(char *filename, int *fd)
+/* map_image does the work for mmap_file and mmap_file_overlay.  An
+   overlay mapping is private, so anything written to it stays in
+   memory and never reaches the disk image. */
+static uint8_t *map_image(char *filename, int *fd, int overlay)
 {
     struct stat statbuf;
     int size;
@@ -49,8 +53,9 @@ uint8_t *mmap_file(char *filename, int *fd)
 
     size = statbuf.st_size;
 
-    /* Step 3: open the file for read/write */
-    *fd = open(pathname, O_RDWR);
+    /* Step 3: open the file for read/write (read only will do for an
+       overlay) */
+    *fd = open(pathname, overlay ? O_RDONLY : O_RDWR);
     if (*fd < 0) {
 	fprintf(stderr, "Cannot read disk image file %s:\n%s\n", 
 		pathname, strerror(errno));
@@ -59,7 +64,8 @@ uint8_t *mmap_file(char *filename, int *fd)
 
     /* Step 3: we memory map the file */
 
-    image_buf = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
+    image_buf = mmap(NULL, size, PROT_READ | PROT_WRITE, 
+		     overlay ? MAP_PRIVATE : MAP_SHARED, *fd, 0);
     if (image_buf == MAP_FAILED) {
 	fprintf(stderr, "Failed to memory map: \n%s\n", strerror(errno));
 	exit(1);
@@ -67,6 +73,19 @@ uint8_t *mmap_file(char *filename, int *fd)
     return image_buf;
 }
 
+/* memory map the FAT-12  disk image file */
+uint8_t *mmap_file(char *filename, int *fd)
+{
+    return map_image(filename, fd, FALSE);
+}
+
+/* memory map the disk image copy-on-write, so that repairs can be
+   tried out (a dry run) without modifying the image */
+uint8_t *mmap_file_overlay(char *filename, int *fd)
+{
+    return map_image(filename, fd, TRUE);
+}
+
 /* read the bootsector from the disk, and check that it is sane */
 /* define DEBUG to see what the disk parameters actually are */
 
@@ -146,7 +165,7 @@ uint16_t get_fat_entry(uint16_t clusternum,
     
     /* this involves some really ugly bit shifting.  This probably
        only works on a little-endian machine. */
-    offset = bpb->bpbResSectors * bpb->bpbBytesPerSec * bpb->bpbSecPerClust 
+    offset = bpb->bpbResSectors * bpb->bpbBytesPerSec 
 	+ (3 * (clusternum/2));
     switch(clusternum % 2) {
     case 0:
@@ -173,7 +192,7 @@ void set_fat_entry(uint16_t clusternum, uint16_t value,
     
     /* this involves some really ugly bit shifting.  This probably
        only works on a little-endian machine. */
-    offset = bpb->bpbResSectors * bpb->bpbBytesPerSec * bpb->bpbSecPerClust 
+    offset = bpb->bpbResSectors * bpb->bpbBytesPerSec 
 	+ (3 * (clusternum/2));
     switch(clusternum % 2) {
     case 0:
@@ -233,3 +252,109 @@ uint8_t *cluster_to_addr(uint16_t cluster, uint8_t *image_buf,
     return p;
 }
 
+
+/* num_clusters returns one past the highest cluster number in the data
+   area, i.e. the number of entries in the FAT that are actually used */
+uint16_t num_clusters(struct bpb33* bpb)
+{
+    uint32_t data_secs;
+    data_secs = bpb->bpbSectors - bpb->bpbResSectors 
+	- (bpb->bpbFATs * bpb->bpbFATsecs)
+	- (bpb->bpbRootDirEnts * sizeof(struct direntry) 
+	   + bpb->bpbBytesPerSec - 1) / bpb->bpbBytesPerSec;
+    return data_secs / bpb->bpbSecPerClust + CLUST_FIRST;
+}
+
+/* mirror_fat copies the first FAT over the backup FATs, so that the
+   copies agree again after set_fat_entry has been used */
+void mirror_fat(uint8_t *image_buf, struct bpb33* bpb)
+{
+    uint32_t fat_bytes;
+    uint8_t *fat;
+    int i;
+
+    fat_bytes = bpb->bpbFATsecs * bpb->bpbBytesPerSec;
+    fat = image_buf + bpb->bpbResSectors * bpb->bpbBytesPerSec;
+    for (i = 1; i < bpb->bpbFATs; i++) {
+	memcpy(fat + i * fat_bytes, fat, fat_bytes);
+    }
+}
+
+/* build_hole_map asks the filesystem once where the data in a sparse
+   image file is (SEEK_DATA/SEEK_HOLE), so that passes which read
+   cluster contents can skip the holes.  If the filesystem doesn't
+   know about holes the whole file comes back as one data extent. */
+struct hole_map *build_hole_map(int fd)
+{
+    struct hole_map *map;
+    struct stat statbuf;
+    off_t pos = 0, data, hole;
+    int cap = 16;
+
+    if (fstat(fd, &statbuf) < 0) {
+	fprintf(stderr, "Cannot stat disk image file:\n%s\n", 
+		strerror(errno));
+	exit(1);
+    }
+
+    map = malloc(sizeof(struct hole_map));
+    map->size = statbuf.st_size;
+    map->n = 0;
+    map->data = malloc(cap * sizeof(struct extent));
+
+    while (pos < map->size) {
+	data = lseek(fd, pos, SEEK_DATA);
+	if (data < 0) {
+	    if (errno == ENXIO)
+		break;		/* the rest of the file is a hole */
+	    data = pos;		/* no hole support, it's all data */
+	    hole = map->size;
+	} else {
+	    hole = lseek(fd, data, SEEK_HOLE);
+	    if (hole < 0)
+		hole = map->size;
+	}
+	if (map->n == cap) {
+	    cap *= 2;
+	    map->data = realloc(map->data, cap * sizeof(struct extent));
+	}
+	map->data[map->n].start = data;
+	map->data[map->n].end = hole;
+	map->n++;
+	pos = hole;
+    }
+    return map;
+}
+
+/* is_hole returns true if no byte in [start, start+len) is stored in
+   the image file, i.e. the range reads back as zeros without I/O */
+int is_hole(struct hole_map *map, off_t start, off_t len)
+{
+    int lo = 0, hi = map->n;
+
+    /* find the first data extent that ends after start */
+    while (lo < hi) {
+	int mid = (lo + hi) / 2;
+	if (map->data[mid].end <= start)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    if (lo < map->n && map->data[lo].start < start + len)
+	return FALSE;
+    return start + len <= map->size;
+}
+
+/* cluster_is_hole returns true if a whole data cluster is in a hole */
+int cluster_is_hole(struct hole_map *map, uint16_t cluster, 
+		    uint8_t *image_buf, struct bpb33* bpb)
+{
+    off_t offset = cluster_to_addr(cluster, image_buf, bpb) - image_buf;
+    return is_hole(map, offset, bpb->bpbBytesPerSec * bpb->bpbSecPerClust);
+}
+
+void free_hole_map(struct hole_map *map)
+{
+    free(map->data);
+    free(map);
+}
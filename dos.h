@@ -12,7 +12,20 @@
 
 #include <stdint.h>
 
+/* the parts of a (possibly sparse) image file that hold data, sorted */
+struct extent {
+    off_t start;
+    off_t end;
+};
+
+struct hole_map {
+    struct extent *data;
+    int n;
+    off_t size;
+};
+
 uint8_t *mmap_file(char *filename, int *fd);
+uint8_t *mmap_file_overlay(char *filename, int *fd);
 struct bpb33* check_bootsector(uint8_t *image_buf);
 uint16_t get_fat_entry(uint16_t clusternum, uint8_t *image_buf, 
 		       struct bpb33* bpb);
@@ -22,3 +35,10 @@ int is_end_of_file(uint16_t cluster) ;
 uint8_t *root_dir_addr(uint8_t *image_buf, struct bpb33* bpb);
 uint8_t *cluster_to_addr(uint16_t cluster, uint8_t *image_buf, 
 			 struct bpb33* bpb);
+uint16_t num_clusters(struct bpb33* bpb);
+void mirror_fat(uint8_t *image_buf, struct bpb33* bpb);
+struct hole_map *build_hole_map(int fd);
+int is_hole(struct hole_map *map, off_t start, off_t len);
+int cluster_is_hole(struct hole_map *map, uint16_t cluster, 
+		    uint8_t *image_buf, struct bpb33* bpb);
+void free_hole_map(struct hole_map *map);
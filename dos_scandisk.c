@@ -9,34 +9,61 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <string.h>
+#include <signal.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "bootsect.h"
 #include "bpb.h"
 #include "direntry.h"
 #include "fat.h"
 #include "dos.h"
-
-#define MAX_NO_FILES 1023
+#include "dos_scandisk.h"
+#include "defrag.h"
+#include "surface.h"
+#include "checksum.h"
+#include "checkpoint.h"
+#include "export.h"
+#include "extract.h"
+#include "classify.h"
+#include "undelete.h"
+#include "lfn.h"
+#include "validate.h"
+#include "owner.h"
+#include "index.h"
+#include "batch.h"
+#include "daemon.h"
+#include "triage.h"
+#include "quick.h"
+#include "fatscan.h"
+#include "walk.h"
+#include "dirwalk.h"
+#include "memcap.h"
+#include "cancel.h"
+#include "diff.h"
+#include "build.h"
+#include "verify.h"
 
 void usage() {
-    fprintf(stderr, "Usage: dos_scandisk <imagename>\n");
+    fprintf(stderr, "Usage: dos_scandisk [--dry-run] [--threads N] [--max-mem MB] [--timeout SECONDS] [--progress] [--defrag | --undelete | --surface] [--checksum | --checksum-update] [--incremental] [--quick] [--export DIR [--export-all]] [--extract DIR] [--index] [--who-owns SECTOR | --ls | --stat PATH | --report | --triage] <imagename>\n"
+                    "       dos_scandisk --diff <imagename> <imagename>\n"
+                    "       dos_scandisk --build DIR [--geometry SECTORS[,SECTOR_SIZE[,CLUSTER_SECTORS[,ROOT_ENTRIES]]]] <imagename>\n"
+                    "       dos_scandisk --batch [--cache DIR] [--cache-size MB] [--threads N] <imagename>...\n"
+                    "       dos_scandisk --watch DIR... --outbox DIR [--socket PATH] [--queue N] [--threads N] [--timeout SECONDS]\n");
     exit(1);
 }
 
-struct file {
-    char name[9];
-    char ext[4];
-    uint32_t size;
-    uint16_t start_cluster;
-    int clusters;
-};
-
 int follow_non_dir(uint16_t cluster, int *visited, uint8_t *image_buf, struct bpb33 *bpb) {
     // Follows a file's linked list to return the number of clusters in the file.
     int clusters = 0;
     while(1) {
         if(is_end_of_file(cluster))
             return clusters;
+        if(cluster < CLUST_FIRST || cluster >= num_clusters(bpb))
+            return clusters;  // empty file, or a broken chain
+        if(scan_step())
+            return clusters;  // out of time, or interrupted
 
         visited[cluster] = 1;
         cluster = get_fat_entry(cluster, image_buf, bpb);  //get next cluster in file
@@ -48,7 +75,7 @@ int follow_unreferenced(uint16_t cluster, int *visited, uint8_t *image_buf, stru
     // similar to follow_non_dir, but prints out each cluster to fulfil question 1
     int clusters = 0;
     while(1) {
-        if(is_end_of_file(cluster))
+        if(is_end_of_file(cluster) || scan_step())
             return clusters;
 
         printf(" %i", cluster);
@@ -58,8 +85,9 @@ int follow_unreferenced(uint16_t cluster, int *visited, uint8_t *image_buf, stru
     }
 }
 
-void change_last_cluster(uint16_t cluster, int free_after, uint8_t *image_buf, struct bpb33 *bpb) {
+void change_last_cluster(uint16_t cluster, int free_after, struct repair_log *log, uint8_t *image_buf, struct bpb33 *bpb) {
     // similar to follow_non_dir, but frees all clusters after a specified nth cluster. (Question 5)
+    // Each FAT entry written goes in log, for verify_repairs.
     int ctr = 1;
     while(1) {
         if(is_end_of_file(cluster))
@@ -68,96 +96,187 @@ void change_last_cluster(uint16_t cluster, int free_after, uint8_t *image_buf, s
         int prev_cluster = cluster;
         cluster = get_fat_entry(cluster, image_buf, bpb);  //get next cluster in file
 
-        if(ctr == free_after)
+        if(ctr == free_after) {
             set_fat_entry(prev_cluster, 4095, image_buf, bpb);
-        if(ctr > free_after)
+            log_fat_entry(log, prev_cluster, 4095);
+        }
+        if(ctr > free_after) {
             set_fat_entry(prev_cluster, 0, image_buf, bpb);
+            log_fat_entry(log, prev_cluster, 0);
+        }
 
         ctr++;
     }
 }
 
-void follow_dir(uint16_t cluster, int *visited, struct file *files, int *filectr, uint8_t *image_buf, struct bpb33 *bpb) {
-    int d, i;
-    struct direntry *dirent = (struct direntry *) cluster_to_addr(cluster, image_buf, bpb);
-    while (1) {
-        visited[cluster] = 1;  // visit current cluster
+void dirent_name(struct direntry *dirent, char *name, char *extension) {
+    // Copies the name and extension out of a direntry as strings (name needs 9 chars, extension 4)
+    int i;
+    name[8] = ' ';
+    extension[3] = ' ';
+    memcpy(name, &(dirent->deName[0]), 8);
+    memcpy(extension, dirent->deExtension, 3);
+
+    /* names are space padded - remove the spaces */
+    for (i = 8; i > 0; i--) {
+        if (name[i] == ' ')
+            name[i] = '\0';
+        else
+            break;
+    }
 
-        // iterate over direntries in current dir
-        for (d = 0; d < bpb->bpbBytesPerSec * bpb->bpbSecPerClust; d += sizeof(struct direntry)) {
-            char name[9], extension[4];
-            uint32_t size;
-            uint16_t file_cluster;
+    /* remove the spaces from extensions (which may be all spaces) */
+    for (i = 3; i >= 0; i--) {
+        if (extension[i] == ' ')
+            extension[i] = '\0';
+        else
+            break;
+    }
+}
 
-            name[8] = ' ';
-            extension[3] = ' ';
-            memcpy(name, &(dirent->deName[0]), 8);
-            memcpy(extension, dirent->deExtension, 3);
+void add_deleted(struct deleted_list *deleted, struct direntry *dirent, uint16_t dir_cluster, int long_name) {
+    if (deleted->n == 0 || (deleted->n & (deleted->n - 1)) == 0)
+        deleted->entries = realloc(deleted->entries, (deleted->n ? 2 * deleted->n : 1) * sizeof(struct deleted_entry));
+    deleted->entries[deleted->n].de = dirent;
+    deleted->entries[deleted->n].dir_cluster = dir_cluster;
+    deleted->entries[deleted->n].long_name = long_name;
+    deleted->n++;
+}
 
-            if (name[0] == SLOT_EMPTY)
-                return;  // we have gone through all entries in root directory
+// what follow_dir's callbacks need
+struct follow {
+    int *visited;
+    struct file **files;
+    int *filectr;
+    struct checkpoint *ck;
+    int ckdir;
+    struct deleted_list *deleted;
+    int deleted_slots;  // the last entry was a deleted long name slot
+    uint8_t *image_buf;
+    struct bpb33 *bpb;
+};
 
-            /* skip over deleted entries */
-            if (((uint8_t) name[0]) == SLOT_DELETED)
-                continue;
+int follow_cluster(uint16_t cluster, void *arg) {
+    struct follow *f = arg;
+    if (scan_step())
+        return 1;  // out of time, or interrupted
+    f->visited[cluster] = 1;  // visit current cluster
+    return 0;
+}
 
-            /* names are space padded - remove the spaces */
-            for (i = 8; i > 0; i--) {
-                if (name[i] == ' ')
-                    name[i] = '\0';
-                else
-                    break;
-            }
+int follow_entry(struct direntry *dirent, struct dir_pos *pos, void *arg) {
+    struct follow *f = arg;
+    struct bpb33 *bpb = f->bpb;
+    char name[9], extension[4];
+    uint32_t size;
+    uint16_t file_cluster;
 
-            /* remove the spaces from extensions */
-            for (i = 3; i > 0; i--) {
-                if (extension[i] == ' ')
-                    extension[i] = '\0';
-                else
-                    break;
-            }
+    if (scan_stopped())
+        return 1;  // the chains from here on would look short
 
-            /* don't need to consider "." or ".." directories */
-            if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
-                dirent++;
-                continue;
-            }
+    /* skip over deleted entries (but remember deleted files if asked to) */
+    if (((uint8_t) dirent->deName[0]) == SLOT_DELETED) {
+        if ((dirent->deAttributes & (ATTR_DIRECTORY | ATTR_VOLUME)) == 0)
+            add_deleted(f->deleted, dirent, pos->dir_cluster, f->deleted_slots);
+        f->deleted_slots = dirent->deAttributes == ATTR_WIN95;
+        return 0;
+    }
+    f->deleted_slots = 0;
 
-            if ((dirent->deAttributes & ATTR_DIRECTORY) != 0) {
-                // If a subdir
-                file_cluster = getushort(dirent->deStartCluster);   // get starting cluster of subdir
-                follow_dir(file_cluster, visited, files, filectr, image_buf, bpb);   // call this function recursively on subdir
-
-            } else if((dirent->deAttributes & ATTR_VOLUME) == 0) {
-                // If a normal file
-                size = getulong(dirent->deFileSize); // get size from direntry
-                file_cluster = getushort(dirent->deStartCluster);   // get starting cluster of file
-                int clusters = follow_non_dir(file_cluster, visited, image_buf, bpb);  // visit clusters used in file
-
-                // add information about file to files array
-                strcpy(files[filectr[0]].name, name);
-                strcpy(files[filectr[0]].ext, extension);
-                files[filectr[0]].size = size;
-                files[filectr[0]].start_cluster = file_cluster;
-                files[filectr[0]].clusters = clusters;
-                filectr[0]++;
-            }
+    /* entries that are garbage rather than files are left out, so their clusters show up as lost */
+    int problems = pos->suspect ? entry_problems(dirent, bpb) : 0;
+    if (problems & DE_GARBAGE) {
+        print_entry_problems(dirent, problems, pos->dir_cluster, stdout);
+        return 0;
+    }
 
-            dirent++; // Get next direntry in dir
-        }
-        if (cluster == 0) {
-            dirent++;  // root dir is special
-        } else {
-            cluster = get_fat_entry(cluster, image_buf, bpb);  // get next cluster in directory
-            dirent = (struct direntry *) cluster_to_addr(cluster, image_buf, bpb);  // get direntry of next cluster
-        }
+    if ((dirent->deAttributes & ATTR_DIRECTORY) != 0) {
+        // If a subdir
+        file_cluster = getushort(dirent->deStartCluster);   // get starting cluster of subdir
+        if (problems)
+            print_entry_problems(dirent, problems, pos->dir_cluster, stdout);
+        if (f->ck)
+            ck_add_item(f->ck, f->ckdir, 1, dirent, NULL, f->image_buf);
+        follow_dir(file_cluster, f->visited, f->files, f->filectr, f->ck, f->deleted, f->image_buf, bpb);   // call this function recursively on subdir
+
+    } else if((dirent->deAttributes & ATTR_VOLUME) == 0) {
+        // If a normal file
+        dirent_name(dirent, name, extension);
+        size = getulong(dirent->deFileSize); // get size from direntry
+        file_cluster = getushort(dirent->deStartCluster);   // get starting cluster of file
+        int clusters = follow_non_dir(file_cluster, f->visited, f->image_buf, bpb);  // visit clusters used in file
+        if (scan_stopped())
+            return 1;
+        if ((uint32_t) clusters < (size + bpb->bpbBytesPerSec * bpb->bpbSecPerClust - 1) / (bpb->bpbBytesPerSec * bpb->bpbSecPerClust))
+            problems |= DE_BAD_SIZE;  // the chain is too short for the size
+        if (problems)
+            print_entry_problems(dirent, problems, pos->dir_cluster, stdout);
+
+        // add information about file to files array
+        struct file *file = add_file(f->files, f->filectr);
+        strcpy(file->name, name);
+        strcpy(file->ext, extension);
+        file->size = size;
+        file->start_cluster = file_cluster;
+        file->clusters = clusters;
+        file->de = dirent;
+        file->lfn = pos->lfn;
+        if (f->ck)
+            ck_add_item(f->ck, f->ckdir, 0, dirent, file, f->image_buf);
     }
+    return 0;
 }
 
-void append_de(struct direntry *de, uint8_t *image_buf, struct bpb33 *bpb) {
+struct file *add_file(struct file **files, int *filectr) {
+    // Appends a zeroed entry to the file table, which grows as the walks fill it
+    *files = capped_grow(*files, *filectr, sizeof(struct file));
+    memset(&(*files)[*filectr], 0, sizeof(struct file));
+    return &(*files)[(*filectr)++];
+}
+
+void follow_dir(uint16_t cluster, int *visited, struct file **files, int *filectr, struct checkpoint *ck, struct deleted_list *deleted, uint8_t *image_buf, struct bpb33 *bpb) {
+    // Walks a directory and its subdirectories, storing the files found in files.
+    // With a checkpoint, directories that haven't changed since the last scan are
+    // taken from it, and the ones that are walked are recorded for the next scan.
+    // With a deleted list, the entries of deleted files are collected in it (and
+    // every directory is walked, as the checkpoint doesn't keep them).
+    struct follow f = {visited, files, filectr, ck, -1, deleted, 0, image_buf, bpb};
+    struct dir_visitor v = {follow_cluster, follow_entry, &f, DIR_VOLUME | DIR_CHECK | (deleted ? DIR_DELETED : 0), stdout};
+    if (ck) {
+        if (!deleted && reuse_dir(ck, cluster, visited, files, filectr, image_buf, bpb))
+            return;
+        f.ckdir = ck_begin_dir(ck, cluster, image_buf, bpb);
+    }
+    scan_dir();
+    for_each_entry(cluster, 0, &v, image_buf, bpb);
+}
+
+int looks_like_dir(uint16_t cluster, uint8_t *image_buf, struct bpb33 *bpb) {
+    // Checks whether a cluster starts with the "." and ".." entries of a directory,
+    // with "." pointing back at the cluster itself.
+    struct direntry *de = (struct direntry *) cluster_to_addr(cluster, image_buf, bpb);
+#ifdef __SSE2__
+    // compare the 11 name bytes of both entries in one go
+    const __m128i dot = _mm_setr_epi8('.', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', 0, 0, 0, 0, 0);
+    const __m128i dotdot = _mm_setr_epi8('.', '.', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', 0, 0, 0, 0, 0);
+    int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((__m128i *) &de[0]), dot))
+        & _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((__m128i *) &de[1]), dotdot));
+    if ((mask & 0x7ff) != 0x7ff)
+        return 0;
+#else
+    if (memcmp(de[0].deName, ".          ", 11) != 0 || memcmp(de[1].deName, "..         ", 11) != 0)
+        return 0;
+#endif
+    return (de[0].deAttributes & ATTR_DIRECTORY) && (de[1].deAttributes & ATTR_DIRECTORY)
+        && getushort(de[0].deStartCluster) == cluster;
+}
+
+struct direntry *append_de(struct direntry *de, uint8_t *image_buf, struct bpb33 *bpb) {
     // appends a new direntry to the end of the root folder's direntries. (Question 3)
+    // Returns where it went, or NULL if the root folder is full.
     struct direntry *dirent = (struct direntry *) cluster_to_addr(0, image_buf, bpb);
-    while (1) {
+    struct direntry *end = dirent + bpb->bpbRootDirEnts;
+    while (dirent < end) {
         // Iterate over direntries in the root folder until we reach the end
         char name[9];
         name[8] = ' ';
@@ -166,39 +285,379 @@ void append_de(struct direntry *de, uint8_t *image_buf, struct bpb33 *bpb) {
         /* we have reached the end of the root direntries - this is where we want to append the new direntry. */
         if (name[0] == SLOT_EMPTY) {
             memcpy(dirent, de, sizeof(struct direntry));
-            return;
+            return dirent;
         }
 
         /* skip over deleted entries */
-        if (((uint8_t) name[0]) == SLOT_DELETED)
+        if (((uint8_t) name[0]) == SLOT_DELETED) {
+            dirent++;
             continue;
+        }
 
         dirent++;
     }
+    return NULL;
+}
+
+int root_free_entries(uint8_t *image_buf, struct bpb33 *bpb) {
+    // how many more direntries append_de can add to the root folder
+    struct direntry *dirent = (struct direntry *) cluster_to_addr(0, image_buf, bpb);
+    int i, n = 0;
+    for(i = 0; i < bpb->bpbRootDirEnts; i++)
+        if(dirent[i].deName[0] == SLOT_EMPTY)
+            n++;
+    return n;
+}
+
+void report_incomplete(int *visited, int filectr, struct bpb33 *bpb) {
+    // What a scan that was stopped got through. Nothing after the walk is trusted, as
+    // the clusters it didn't reach would all look lost, so no repairs are made.
+    int i, followed = 0;
+    for(i = CLUST_FIRST; i < num_clusters(bpb); i++)
+        followed += visited[i] != 0;
+    printf("Incomplete: %s after %.1fs, with %i of %i clusters and %li directories walked (%i files found); "
+           "lost files and sizes not repaired\n", scan_stop_reason(), scan_elapsed() / 1000.0,
+           followed, num_clusters(bpb) - CLUST_FIRST, scan_control->dirs, filectr);
 }
 
 int main(int argc, char **argv) {
-    // Check that no. of arguments is correct
-    if (argc < 2 || argc > 2)
+    // Parse options; there must be exactly one image name
+    char *imagename = NULL;
+    int dry_run = 0, quick = 0, defrag = 0, surface = 0, checksum = 0, checksum_update = 0, incremental = 0, export_all = 0, undelete = 0, i;
+    char *export_dir = NULL, *extract_dir = NULL, *build_dir = NULL;
+    struct build_geometry geometry = {2880, 512, 1, 224};  // a 1.44MB floppy
+    int nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    long who_owns = -1;
+    size_t max_mem = 0;
+    long timeout = 0, progress = 0;
+    int write_index = 0, list = 0, report = 0, batch = 0, diff = 0, custom_geometry = 0, nimages = 0, triage_only = 0, triage;
+    char why[128];
+    char *stat_path = NULL, **images = calloc(argc, sizeof(char *));
+    struct result_cache cache = {".scandisk-cache", 64 << 20, 0, 0, 0, 0};
+    struct daemon_config daemon = {calloc(argc, sizeof(char *)), 0, NULL, NULL, 0, 64, 0};
+    for(i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "--dry-run") == 0)
+            dry_run = 1;
+        else if(strcmp(argv[i], "--defrag") == 0)
+            defrag = 1;
+        else if(strcmp(argv[i], "--undelete") == 0)
+            undelete = 1;
+        else if(strcmp(argv[i], "--surface") == 0)
+            surface = 1;
+        else if(strcmp(argv[i], "--checksum") == 0)
+            checksum = 1;
+        else if(strcmp(argv[i], "--checksum-update") == 0)
+            checksum = checksum_update = 1;
+        else if(strcmp(argv[i], "--incremental") == 0)
+            incremental = 1;
+        else if(strcmp(argv[i], "--quick") == 0)
+            quick = 1;
+        else if(strcmp(argv[i], "--export") == 0 && i + 1 < argc)
+            export_dir = argv[++i];
+        else if(strcmp(argv[i], "--extract") == 0 && i + 1 < argc)
+            extract_dir = argv[++i];
+        else if(strcmp(argv[i], "--export-all") == 0)
+            export_all = 1;
+        else if(strcmp(argv[i], "--index") == 0)
+            write_index = 1;
+        else if(strcmp(argv[i], "--ls") == 0)
+            list = 1;
+        else if(strcmp(argv[i], "--stat") == 0 && i + 1 < argc)
+            stat_path = argv[++i];
+        else if(strcmp(argv[i], "--report") == 0)
+            report = 1;
+        else if(strcmp(argv[i], "--who-owns") == 0 && i + 1 < argc)
+            who_owns = atol(argv[++i]);
+        else if(strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            nthreads = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--max-mem") == 0 && i + 1 < argc)
+            max_mem = atoll(argv[++i]) << 20;
+        else if(strcmp(argv[i], "--timeout") == 0 && i + 1 < argc)
+            timeout = atof(argv[++i]) * 1000;
+        else if(strcmp(argv[i], "--progress") == 0)
+            progress = 1000;
+        else if(strcmp(argv[i], "--triage") == 0)
+            triage_only = 1;
+        else if(strcmp(argv[i], "--batch") == 0)
+            batch = 1;
+        else if(strcmp(argv[i], "--diff") == 0)
+            diff = 1;
+        else if(strcmp(argv[i], "--build") == 0 && i + 1 < argc)
+            build_dir = argv[++i];
+        else if(strcmp(argv[i], "--geometry") == 0 && i + 1 < argc) {
+            if(!parse_geometry(argv[++i], &geometry))
+                usage();
+            custom_geometry = 1;
+        }
+        else if(strcmp(argv[i], "--cache") == 0 && i + 1 < argc)
+            cache.dir = argv[++i];
+        else if(strcmp(argv[i], "--cache-size") == 0 && i + 1 < argc)
+            cache.limit = atoll(argv[++i]) << 20;
+        else if(strcmp(argv[i], "--watch") == 0 && i + 1 < argc)
+            daemon.watch[daemon.nwatch++] = argv[++i];
+        else if(strcmp(argv[i], "--outbox") == 0 && i + 1 < argc)
+            daemon.outbox = argv[++i];
+        else if(strcmp(argv[i], "--socket") == 0 && i + 1 < argc)
+            daemon.socket = argv[++i];
+        else if(strcmp(argv[i], "--queue") == 0 && i + 1 < argc)
+            daemon.queue_size = atoi(argv[++i]);
+        else if(argv[i][0] == '-')
+            usage();
+        else
+            images[nimages++] = argv[i];
+    }
+    if(daemon.nwatch) {
+        // Scan images as they arrive in the watched directories, until stopped
+        if(nimages || !daemon.outbox || daemon.queue_size < 1)
+            usage();
+        daemon.workers = nthreads > 0 ? nthreads : 1;
+        daemon.timeout = timeout;
+        exit(run_daemon(&daemon));
+    }
+    if(custom_geometry && !build_dir)
         usage();
+    if(build_dir) {
+        // Make a new image from a host directory instead of checking one
+        if(nimages != 1 || argc != (custom_geometry ? 6 : 4))
+            usage();
+        exit(build_image(images[0], build_dir, &geometry));
+    }
+    if(diff) {
+        // Compare two images of the same volume instead of checking either
+        if(nimages != 2 || batch || argc != 4)
+            usage();
+        for(i = 0; i < 2; i++) {
+            triage = triage_image(images[i], why, sizeof(why));
+            if(triage == TRIAGE_JUNK) {
+                printf("Triage: %s: %s (%s)\n", images[i], triage_name(triage), why);
+                exit(1);
+            }
+        }
+        exit(diff_images(images[0], images[1]));
+    }
+    if(nimages == 0 || (nimages > 1 && !batch) || (export_all && !export_dir) || (write_index && dry_run))
+        usage();
+    if(quick && (defrag || undelete || surface || checksum || incremental || export_dir || extract_dir || write_index))
+        usage();  // it only answers whether the disk is clean
+    imagename = images[0];
+
+    if(batch) {
+        // Only the plain check is cached, as its report depends on nothing but the image
+        if(defrag || undelete || surface || checksum || incremental || export_dir || extract_dir
+           || write_index || list || stat_path || report || who_owns >= 0 || triage_only)
+            usage();
+        imagename = run_batch(images, nimages, &cache);  // returns in the child that checks one image
+        dry_run = 1;
+    }
+
+    // Queries are answered from the index a scan with --index left, without reading the
+    // image again (apart from checking it hasn't changed)
+    char idxpath[MAXPATHLEN + 5];
+    snprintf(idxpath, sizeof(idxpath), "%s.idx", imagename);
+    if(list || stat_path || report || who_owns >= 0) {
+        struct scan_index *ix = open_scan_index(idxpath, imagename);
+        int status = 0;
+        if(ix) {
+            if(list)
+                index_list(ix);
+            if(stat_path && index_stat(ix, stat_path) < 0)
+                status = 1;
+            if(report)
+                index_report(ix);
+            if(who_owns >= 0)
+                print_sector_owner(&ix->owners, who_owns, &ix->bpb);
+            close_scan_index(ix);
+            exit(status);
+        } else if(list || stat_path || report) {
+            fprintf(stderr, "No up to date index for %s, scan it with --index first\n", imagename);
+            exit(1);
+        }
+    }
+
+    // Look at the boot sector and FAT before mapping anything, and give up on junk
+    triage = triage_image(imagename, why, sizeof(why));
+    if(triage_only || triage != TRIAGE_VALID)
+        printf("Triage: %s%s%s%s\n", triage_name(triage), why[0] ? " (" : "", why, why[0] ? ")" : "");
+    if(triage_only)
+        exit(triage);
+    if(triage == TRIAGE_JUNK)
+        exit(1);
 
-    // Initialise image_buf and bpb
+    if(max_mem)
+        set_memory_cap(max_mem, dry_run);
+
+    // Initialise image_buf and bpb. A dry run works on a private overlay of the image.
     int fd;
-    uint8_t *image_buf = mmap_file(argv[1], &fd);
+    uint8_t *image_buf = dry_run ? mmap_file_overlay(imagename, &fd) : mmap_file(imagename, &fd);
     struct bpb33 *bpb = check_bootsector(image_buf);
 
+    if(who_owns >= 0) {
+        // Just say which file uses a sector, without checking the disk
+        struct owner_index *owners = build_owner_index(image_buf, bpb);
+        print_sector_owner(owners, who_owns, bpb);
+        free_owner_index(owners);
+        close(fd);
+        exit(0);
+    }
+
     // Store information on all referenced files and visit the clusters they use
-    int *visited = malloc(bpb->bpbSectors / bpb->bpbSecPerClust * sizeof(int));  // boolean array of clusters used in files
-    struct file *files = malloc(MAX_NO_FILES * sizeof(struct file));
+    int *visited = capped_calloc(bpb->bpbSectors / bpb->bpbSecPerClust, sizeof(int));  // boolean array of clusters used in files
+    struct file *files = NULL;  // grown by add_file
     int filectr = 0;
-    follow_dir(0, visited, files, &filectr, image_buf, bpb);
+
+    // An incremental scan only walks the directories that changed since the last one
+    char ckpath[MAXPATHLEN + 6];
+    struct checkpoint *ck = NULL;
+    if(incremental) {
+        snprintf(ckpath, sizeof(ckpath), "%s.ckpt", imagename);
+        ck = load_checkpoint(ckpath, image_buf, bpb);
+        if(!defrag && !undelete && !surface && !checksum && !export_dir && ck->old_clean && checkpoint_unchanged(ck, image_buf, bpb)) {
+            printf("Checkpoint: FAT and directories unchanged, still clean (%i files)\n", ck->old_files);
+            close(fd);
+            exit(0);
+        }
+    }
+
+    // A quick scan first looks at the FAT alone, and only walks the tree if something is off
+    char qckpath[MAXPATHLEN + 5];
+    if(quick) {
+        snprintf(qckpath, sizeof(qckpath), "%s.qck", imagename);
+        if(quick_check(qckpath, why, sizeof(why), nthreads, image_buf, bpb)) {
+            printf("Quick: clean, decided by the FAT check (%s)\n", why);
+            close(fd);
+            exit(0);
+        }
+        printf("Quick: %s, escalating to the full scan\n", why);
+    }
+
+    // From here the walks give up at the deadline or on SIGINT/SIGTERM, and report progress
+    start_scan_control(timeout, progress, num_clusters(bpb) - CLUST_FIRST, NULL);
+
+    struct deleted_list deleted = {NULL, 0};
+    if(ck || undelete)
+        follow_dir(0, visited, &files, &filectr, ck, undelete ? &deleted : NULL, image_buf, bpb);
+    else
+        walk_tree(nthreads, visited, &files, &filectr, image_buf, bpb);  // the same walk, on every thread
+    if(scan_stopped()) {
+        report_incomplete(visited, filectr, bpb);
+        close(fd);
+        exit(3);
+    }
+    if(ck)
+        ck_finish_walk(ck, image_buf, bpb);
+    check_long_names(files, filectr, image_buf, bpb);
+
+    if(undelete) {
+        // Bring back the deleted files whose clusters are still free instead of checking the disk
+        undelete_files(&deleted, image_buf, bpb);
+        if(dry_run)
+            printf("Dry run: image not modified\n");
+        close(fd);
+        exit(0);
+    }
+
+    if(defrag) {
+        // Make every file contiguous instead of checking the disk
+        struct defrag_plan plan;
+        plan_defrag(&plan, files, filectr, image_buf, bpb);
+        print_defrag_plan(&plan, files);
+        execute_defrag(&plan, files, image_buf, bpb);
+        if(dry_run)
+            printf("Dry run: image not modified\n");
+        close(fd);
+        exit(0);
+    }
+
+    // Passes that look at cluster contents skip the holes of sparse images
+    struct hole_map *holes = NULL;
+    if(surface || checksum || export_dir || extract_dir)
+        holes = build_hole_map(fd);
+
+    if(surface) {
+        // Read every data cluster and take unreadable ones out of use before looking for lost files
+        uint8_t *bad = calloc(num_clusters(bpb), 1);
+        int nbad = surface_scan(fd, holes, bad, nthreads, image_buf, bpb);
+        printf("Surface scan: %i unreadable clusters\n", nbad);
+        report_zero_filled(holes, files, filectr, image_buf, bpb);
+        if(nbad)
+            mark_bad_clusters(bad, visited, files, filectr, image_buf, bpb);
+        free(bad);
+    }
+
+    if(checksum) {
+        // Check every allocated cluster against the checksums saved by an earlier run,
+        // or save them if there aren't any yet
+        char sidecar[MAXPATHLEN + 5];
+        uint32_t *crcs = malloc(num_clusters(bpb) * sizeof(uint32_t));
+        uint8_t *allocated = malloc(num_clusters(bpb));
+        int changed = -1;
+        snprintf(sidecar, sizeof(sidecar), "%s.crc", imagename);
+        checksum_clusters(crcs, allocated, holes, nthreads, image_buf, bpb);
+        if(!checksum_update)
+            changed = verify_checksums(sidecar, crcs, allocated, files, filectr, image_buf, bpb);
+        if(changed >= 0)
+            printf("Checksum: %i clusters changed since %s was saved\n", changed, sidecar);
+        else if(write_checksums(sidecar, crcs, allocated, bpb) == 0)
+            printf("Checksum: saved %s\n", sidecar);
+        free(allocated);
+        free(crcs);
+    }
+
+    // The sweeps for lost clusters below work from one parallel pass over the FAT
+    struct fat_summary *fs = analyse_fat(nthreads, image_buf, bpb);
+
+    // Look for lost directories first: following one visits its whole subtree, so the
+    // files in it don't each show up as lost files. A lost directory inside another
+    // lost directory is left to its parent. Only as many as fit in the root folder are
+    // kept to be linked; the rest are still followed, so they are listed but stay lost.
+    int room = root_free_entries(image_buf, bpb), noroom = 0;
+    struct file *unref = capped_calloc(room + 1, sizeof(struct file));
+    int unrefctr = 0, lostfiles = 0, unnamed = 0, printed = 0, oversized = 0;
+    uint16_t *lostdirs = malloc(num_clusters(bpb) * sizeof(uint16_t));
+    int nlostdirs = 0, unnameddirs = 0;
+    unsigned lostdirnames = 0;
+    int window = memory_cap ? memory_cap->window / (bpb->bpbBytesPerSec * bpb->bpbSecPerClust) + 1 : 0;
+    for(i = CLUST_FIRST; i < num_clusters(bpb); i++) {
+        if(!visited[i] && cluster_allocated(fs, i) && looks_like_dir(i, image_buf, bpb))
+            lostdirs[nlostdirs++] = i;
+        if(window && (i - CLUST_FIRST + 1) % window == 0)  // under --max-mem, a window of clusters at a time
+            release_image(cluster_to_addr(i + 1 - window, image_buf, bpb), window * bpb->bpbBytesPerSec * bpb->bpbSecPerClust);
+    }
+    for(i = 0; i < nlostdirs; i++) {
+        struct direntry *dots = (struct direntry *) cluster_to_addr(lostdirs[i], image_buf, bpb);
+        uint16_t parent = getushort(dots[1].deStartCluster);
+        if(parent >= CLUST_FIRST && parent < num_clusters(bpb) && parent != lostdirs[i]
+           && !visited[parent] && looks_like_dir(parent, image_buf, bpb))
+            lostdirs[i] = 0;
+    }
+    for(i = 0; i < nlostdirs && !scan_stopped(); i++) {
+        if(!lostdirs[i] || visited[lostdirs[i]])
+            continue;
+        follow_dir(lostdirs[i], visited, &files, &filectr, NULL, NULL, image_buf, bpb);
+        int clusters = follow_non_dir(lostdirs[i], visited, image_buf, bpb);
+        if(unrefctr == room) {
+            noroom++;
+            continue;
+        }
+        if(lostdirnames >= 1000) {  // FOUND.999 is the last name with a 3 digit extension
+            unnameddirs++;
+            continue;
+        }
+        strcpy(unref[unrefctr].name, "FOUND");
+        snprintf(unref[unrefctr].ext, sizeof(unref[unrefctr].ext), "%03u", lostdirnames++);
+        unref[unrefctr].start_cluster = lostdirs[i];
+        unref[unrefctr].clusters = clusters;
+        unref[unrefctr].is_dir = 1;
+        unrefctr++;
+    }
+    free(lostdirs);
+    if(unnameddirs)
+        printf("Not linked: %i lost directories, there are no FOUND.nnn names left\n", unnameddirs);
 
     // Look for clusters contained in unreferenced files and print them
     // Also store information about each unreferenced file
-    struct file *unref = malloc(MAX_NO_FILES * sizeof(struct file));
-    int unrefctr = 0, printed = 0, i;
-    for(i=2; i < bpb->bpbSectors / bpb->bpbSecPerClust; i++) {
-        if(visited[i] || !get_fat_entry(i, image_buf, bpb))  // cluster referenced or is empty
+    for(i=2; i < num_clusters(bpb) && !scan_stopped(); i++) {
+        if(visited[i] || !cluster_allocated(fs, i))  // cluster referenced, empty or marked bad
             continue;
 
         if(!printed) {
@@ -207,47 +666,142 @@ int main(int argc, char **argv) {
         }
 
         int clusters = follow_unreferenced(i, visited, image_buf, bpb);
-        char filename[9];
-        sprintf(filename, "FOUND%i", unrefctr + 1);
+        if(unrefctr == room) {
+            noroom++;
+            continue;
+        }
+        if(lostfiles >= 999) {  // FOUND999 is the last name that fits in 8 characters
+            unnamed++;
+            continue;
+        }
+        char filename[20];  // room for any counter, though only up to FOUND999 is used
+        snprintf(filename, sizeof(filename), "FOUND%i", ++lostfiles);
         strcpy(unref[unrefctr].name, filename);
         strcpy(unref[unrefctr].ext, "DAT");
         unref[unrefctr].size = clusters * bpb->bpbBytesPerSec * bpb->bpbSecPerClust;
+
+        // Guess what the file is from its first cluster, and its real length if the format records it
+        uint32_t length = 0;
+        const char *type = classify_cluster(cluster_to_addr(i, image_buf, bpb), bpb->bpbBytesPerSec * bpb->bpbSecPerClust, &length);
+        if(type) {
+            strcpy(unref[unrefctr].ext, type);
+            unref[unrefctr].classified = 1;
+        }
+        if(length > 0 && length <= unref[unrefctr].size)
+            unref[unrefctr].size = length;
         unref[unrefctr].start_cluster = i;
         unref[unrefctr].clusters = clusters;
         unrefctr++;
     }
     printf("\n");
+    if(scan_stopped()) {
+        report_incomplete(visited, filectr, bpb);
+        close(fd);
+        exit(3);
+    }
+    if(unnamed)
+        printf("Not linked: %i lost files, there are no FOUNDn.DAT names left\n", unnamed);
+    if(noroom)
+        printf("Not linked: %i lost files and directories, the root directory is full\n", noroom);
+
+    if(export_dir) {
+        // Copy the lost files (and with --export-all the referenced ones too) out of the image
+        for(i = 0; i < unrefctr + (export_all ? filectr : 0); i++) {
+            struct file *f = i < unrefctr ? &unref[i] : &files[i - unrefctr];
+            if(f->is_dir)
+                continue;  // its files are exported with the referenced ones
+            char longname[4 * WIN_MAXLEN + 1];
+            int outfd;
+            if(lfn_name(&f->lfn, f->de, longname, sizeof(longname), image_buf, bpb))
+                outfd = create_export_file(export_dir, longname, "");
+            else
+                outfd = create_export_file(export_dir, f->name, f->ext);
+            if(outfd < 0)
+                continue;
+            if(export_chain(fd, holes, f->start_cluster, f->size, outfd, image_buf, bpb) < 0)
+                fprintf(stderr, "Cannot export %s.%s: %s\n", f->name, f->ext, strerror(errno));
+            close(outfd);
+        }
+    }
 
     // For each unreferenced file, print information about the file and create a new direntry on root that links to them
-    for(i=0; i < MAX_NO_FILES; i++) {
-        if(!unref[i].size)  // Empty (size = 0)
-            break;
-
-        printf("Lost file: %i %i\n", unref[i].start_cluster, unref[i].clusters);
-
+    struct repair_log repairs = {NULL, 0, NULL, 0, calloc(unrefctr + 1, sizeof(struct direntry *))};
+    for(i=0; i < unrefctr; i++) {
         // create new direntry for the unreferenced file
-        struct direntry *newde = malloc(sizeof(struct direntry));
-        memcpy(newde->deName, unref[i].name, 8);
-        memcpy(newde->deExtension, unref[i].ext, 3);
-        newde->deAttributes = 0x20;  // set as normal file (not e.g. a directory)
+        struct direntry *newde = calloc(1, sizeof(struct direntry));
+        memset(newde->deName, ' ', 11);
+        memcpy(newde->deName, unref[i].name, strlen(unref[i].name));
+        memcpy(newde->deExtension, unref[i].ext, strlen(unref[i].ext));  // space padded, like the name ("GZ " for a .gz)
         putushort(newde->deStartCluster, unref[i].start_cluster);
         putulong(newde->deFileSize, unref[i].size);
 
-        append_de(newde, image_buf, bpb);  // Append new direntry to root
+        if(unref[i].is_dir) {
+            printf("Lost directory: %i %i\n", unref[i].start_cluster, unref[i].clusters);
+            newde->deAttributes = ATTR_DIRECTORY;
+            // its ".." entry now has to point at the root
+            struct direntry *dots = (struct direntry *) cluster_to_addr(unref[i].start_cluster, image_buf, bpb);
+            putushort(dots[1].deStartCluster, MSDOSFSROOT);
+        } else {
+            printf("Lost file: %i %i", unref[i].start_cluster, unref[i].clusters);
+            if(unref[i].classified)
+                printf(" (%s, %i bytes)", unref[i].ext, unref[i].size);
+            printf("\n");
+            newde->deAttributes = 0x20;  // set as normal file (not e.g. a directory)
+        }
+
+        repairs.entries[i] = append_de(newde, image_buf, bpb);  // Append new direntry to root
     }
 
     // For each file, check if its size in the directory entry is inconsistent with its size in the FAT (no. of clusters)
     // If they are inconsistent, print information about the file and free clusters beyond the end of file in the direntry
-    for(i=0; i < MAX_NO_FILES; i++) {
-        if(!files[i].size)  // Empty (size = 0)
-            break;
-
+    for(i=0; i < filectr; i++) {
         if(files[i].size / (bpb->bpbBytesPerSec * bpb->bpbSecPerClust) + 1 < files[i].clusters) {
-            printf("%s.%s %i %i\n", files[i].name, files[i].ext, files[i].size, files[i].clusters * bpb->bpbBytesPerSec * bpb->bpbSecPerClust);
-            change_last_cluster(files[i].start_cluster, files[i].size / (bpb->bpbBytesPerSec * bpb->bpbSecPerClust) + 1, image_buf, bpb);
+            char display[4 * WIN_MAXLEN + 1];
+            file_display_name(&files[i], display, sizeof(display), image_buf, bpb);
+            oversized++;
+            files[i].oversized = 1;
+            printf("%s %i %i\n", display, files[i].size, files[i].clusters * bpb->bpbBytesPerSec * bpb->bpbSecPerClust);
+            change_last_cluster(files[i].start_cluster, files[i].size / (bpb->bpbBytesPerSec * bpb->bpbSecPerClust) + 1, &repairs, image_buf, bpb);
         }
     }
 
+    // Check that the repairs left the disk consistent, looking only at what they touched
+    if((unrefctr || oversized) && verify_repairs(&repairs, unref, unrefctr, files, filectr, fs, image_buf, bpb)) {
+        close(fd);
+        exit(4);
+    }
+    free_repair_log(&repairs);
+    free_fat_summary(fs);
+
+    if(extract_dir) {
+        // Copy the whole (repaired) tree out of the image
+        if(extract_tree(extract_dir, fd, holes, nthreads, image_buf, bpb))
+            fprintf(stderr, "Some files could not be extracted\n");
+    }
+    if(holes)
+        free_hole_map(holes);
+
+    if(write_index && write_scan_index(idxpath, imagename, unref, unrefctr, files, filectr, image_buf, bpb) == 0)
+        printf("Index: saved %s\n", idxpath);
+
+    if(ck) {
+        // Save what this scan saw (before any repairs) for the next incremental scan
+        printf("Checkpoint: reused %i of %i directories\n", ck->reused, ck->nnew);
+        save_checkpoint(ck, ckpath, !unrefctr && !oversized, filectr);
+    }
+    report_memory_cap();
+
+    if(quick) {
+        // The scan trusted the first FAT, so the backup copies are brought in line with it.
+        // Only a clean disk gives totals worth comparing against next time.
+        int mismatched = fat_copy_differs(image_buf, bpb);
+        if(mismatched)
+            mirror_fat(image_buf, bpb);
+        printf("Quick: %s, decided by the full scan\n", !unrefctr && !oversized && !mismatched ? "clean" : "repaired");
+        if(!unrefctr && !oversized && !mismatched)
+            save_quick_totals(qckpath, visited, filectr, nthreads, image_buf, bpb);
+    }
+
     close(fd);
     exit(0);
 }
\ No newline at end of file
@@ -0,0 +1,46 @@
+/* By: Bagus Maulana */
+
+/* types and prototypes shared between dos_scandisk.c and the modules
+   that work on its scan results */
+
+// where the long name slots of an entry are: entries first .. first + slots - 1 of the
+// directory starting at dir_cluster (slots is 0 if the entry has no long name)
+struct lfn_run {
+    uint16_t dir_cluster;
+    uint16_t first;
+    uint8_t slots;
+};
+
+struct file {
+    char name[9];
+    char ext[4];
+    uint32_t size;
+    uint16_t start_cluster;
+    int clusters;
+    struct direntry *de;  // the file's direntry in the image
+    struct lfn_run lfn;   // its long name, decoded by lfn.c only when needed
+    int is_dir;           // only used for lost directories
+    int classified;       // only used for lost files: ext was guessed from the contents
+    int oversized;        // its chain was longer than its size, and has been cut
+};
+
+struct checkpoint;
+
+// a deleted file's direntry, and what undelete needs to know about it
+struct deleted_entry {
+    struct direntry *de;
+    uint16_t dir_cluster;  // the directory it is in
+    int long_name;         // it had long name slots (deleted with it)
+};
+
+// direntries of deleted files, collected by follow_dir
+struct deleted_list {
+    struct deleted_entry *entries;
+    int n;
+};
+
+void dirent_name(struct direntry *dirent, char *name, char *extension);
+int follow_non_dir(uint16_t cluster, int *visited, uint8_t *image_buf, struct bpb33 *bpb);
+void add_deleted(struct deleted_list *deleted, struct direntry *dirent, uint16_t dir_cluster, int long_name);
+struct file *add_file(struct file **files, int *filectr);
+void follow_dir(uint16_t cluster, int *visited, struct file **files, int *filectr, struct checkpoint *ck, struct deleted_list *deleted, uint8_t *image_buf, struct bpb33 *bpb);
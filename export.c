@@ -0,0 +1,117 @@
+/* By: Bagus Maulana */
+
+#define _GNU_SOURCE  // for copy_file_range
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+
+#include "bootsect.h"
+#include "bpb.h"
+#include "direntry.h"
+#include "fat.h"
+#include "dos.h"
+#include "dos_scandisk.h"
+#include "lfn.h"
+#include "export.h"
+
+int copy_extent(int fd, off_t in_off, int outfd, off_t out_off, size_t len) {
+    // Copies len bytes from the image to the output file inside the kernel, with
+    // copy_file_range if the filesystems allow it and sendfile otherwise.
+    // Returns 0, or -1 with errno set.
+    static int no_copy_file_range = 0;
+    ssize_t n;
+
+    while(len > 0 && !no_copy_file_range) {
+        n = copy_file_range(fd, &in_off, outfd, &out_off, len, 0);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n < 0 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP)) {
+            no_copy_file_range = 1;
+            break;
+        }
+        if(n == 0)
+            errno = EIO;  // the image ended early
+        if(n <= 0)
+            return -1;
+        len -= n;
+    }
+    if(len > 0 && lseek(outfd, out_off, SEEK_SET) < 0)
+        return -1;
+    while(len > 0) {
+        n = sendfile(outfd, fd, &in_off, len);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n == 0)
+            errno = EIO;  // the image ended early
+        if(n <= 0)
+            return -1;
+        len -= n;
+    }
+    return 0;
+}
+
+int export_chain(int fd, struct hole_map *holes, uint16_t cluster, uint32_t size, int outfd, uint8_t *image_buf, struct bpb33 *bpb) {
+    // Writes the first size bytes of the chain starting at cluster to outfd. Runs of
+    // consecutive clusters are copied as one extent, and extents in a hole of the
+    // image are left as holes in the output. Returns 0, or -1 with errno set.
+    int nclust = num_clusters(bpb), cluster_size = bpb->bpbBytesPerSec * bpb->bpbSecPerClust, steps = 0;
+    off_t start, out_off = 0;
+    size_t len;
+    uint16_t next;
+
+    while(out_off < size && cluster >= CLUST_FIRST && cluster < nclust && steps < nclust) {
+        // extend the extent while the chain carries on into the next cluster
+        start = cluster_to_addr(cluster, image_buf, bpb) - image_buf;
+        len = cluster_size;
+        steps++;
+        next = get_fat_entry(cluster, image_buf, bpb);
+        while(next == cluster + 1 && out_off + len < size && steps < nclust) {
+            cluster = next;
+            len += cluster_size;
+            steps++;
+            next = get_fat_entry(cluster, image_buf, bpb);
+        }
+        if(out_off + len > size)
+            len = size - out_off;
+
+        if(!is_hole(holes, start, len) && copy_extent(fd, start, outfd, out_off, len) < 0)
+            return -1;
+        out_off += len;
+        cluster = next;
+    }
+    return ftruncate(outfd, out_off);  // the file may end in a hole
+}
+
+int create_export_file(char *dir, char *name, char *ext) {
+    // Creates dir/NAME.EXT, or NAME~n.EXT if a file by that name was already exported.
+    // The name comes off the disk, so it is made safe first so it can't leave dir.
+    // Returns the new file descriptor or -1.
+    char path[MAXPATHLEN + 1], base[MAXPATHLEN + 1], safe[MAXPATHLEN + 1];
+    int n, outfd;
+
+    for(n = 0; n < 1000; n++) {
+        if(n == 0)
+            snprintf(base, sizeof(base), "%s", name);
+        else
+            snprintf(base, sizeof(base), "%s~%i", name, n);
+        short_host_name(safe, sizeof(safe), base, ext);
+        if(snprintf(path, sizeof(path), "%s/%s", dir, safe) >= (int) sizeof(path)) {
+            outfd = -1;
+            errno = ENAMETOOLONG;
+            break;
+        }
+        outfd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+        if(outfd >= 0 || errno != EEXIST)
+            break;
+    }
+    if(outfd < 0)
+        fprintf(stderr, "Cannot create %s: %s\n", path, strerror(errno));
+    return outfd;
+}
@@ -0,0 +1,6 @@
+/* By: Bagus Maulana */
+
+/* prototypes for functions in export.c */
+
+int export_chain(int fd, struct hole_map *holes, uint16_t cluster, uint32_t size, int outfd, uint8_t *image_buf, struct bpb33 *bpb);
+int create_export_file(char *dir, char *name, char *ext);
@@ -0,0 +1,238 @@
+/* By: Bagus Maulana */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "bootsect.h"
+#include "bpb.h"
+#include "direntry.h"
+#include "fat.h"
+#include "dos.h"
+#include "dos_scandisk.h"
+#include "export.h"
+#include "extract.h"
+#include "dirwalk.h"
+
+struct extract_job {
+    char *path;             // host path, under the extraction root ("/DIR/FILE.TXT")
+    uint16_t start_cluster;
+    uint32_t size;
+    int is_dir;
+    time_t mtime;
+};
+
+struct extract {
+    struct extract_job *jobs;
+    int njobs, cap;
+    int next;               // next job for a worker to take
+    int failed;
+    char *dir;              // the extraction root
+    int rootfd;
+    int fd;
+    struct hole_map *holes;
+    uint8_t *image_buf;
+    struct bpb33 *bpb;
+};
+
+time_t dos_time(uint8_t *date, uint8_t *time) {
+    // Converts a DOS date and time (local time) from a direntry to a time_t.
+    // Returns -1 if the entry has no date.
+    struct tm tm;
+    uint16_t d = getushort(date), t = getushort(time);
+
+    if(d == 0)
+        return -1;
+    memset(&tm, 0, sizeof(tm));
+    tm.tm_year = ((d & DD_YEAR_MASK) >> DD_YEAR_SHIFT) + 80;
+    tm.tm_mon = ((d & DD_MONTH_MASK) >> DD_MONTH_SHIFT) - 1;
+    tm.tm_mday = (d & DD_DAY_MASK) >> DD_DAY_SHIFT;
+    tm.tm_hour = (t & DT_HOURS_MASK) >> DT_HOURS_SHIFT;
+    tm.tm_min = (t & DT_MINUTES_MASK) >> DT_MINUTES_SHIFT;
+    tm.tm_sec = ((t & DT_2SECONDS_MASK) >> DT_2SECONDS_SHIFT) * 2;
+    tm.tm_isdst = -1;
+    return mktime(&tm);
+}
+
+void add_job(struct extract *ex, char *path, struct direntry *dirent, int is_dir) {
+    if(ex->njobs == ex->cap) {
+        ex->cap = ex->cap ? 2 * ex->cap : 64;
+        ex->jobs = realloc(ex->jobs, ex->cap * sizeof(struct extract_job));
+    }
+    ex->jobs[ex->njobs].path = strdup(path);
+    ex->jobs[ex->njobs].start_cluster = getushort(dirent->deStartCluster);
+    ex->jobs[ex->njobs].size = getulong(dirent->deFileSize);
+    ex->jobs[ex->njobs].is_dir = is_dir;
+    ex->jobs[ex->njobs].mtime = dos_time(dirent->deMDate, dirent->deMTime);
+    ex->njobs++;
+}
+
+int open_parent(int rootfd, const char *path, const char **last) {
+    // Opens the directory path is in, a component at a time from the extraction root
+    // without following symbolic links, so nothing outside the root can be reached even
+    // if a link is planted on the host meanwhile. Sets *last to path's last component.
+    // Returns the directory's descriptor, or -1 with errno set.
+    char comp[MAXPATHLEN + 1];
+    const char *p = path, *slash;
+    int fd = dup(rootfd), next;
+
+    while(fd >= 0) {
+        while(*p == '/')
+            p++;
+        slash = strchr(p, '/');
+        if(!slash)
+            break;
+        memcpy(comp, p, slash - p);
+        comp[slash - p] = '\0';
+        if(strcmp(comp, ".") == 0 || strcmp(comp, "..") == 0) {
+            close(fd);
+            errno = EINVAL;
+            return -1;
+        }
+        next = openat(fd, comp, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+        close(fd);
+        fd = next;
+        p = slash;
+    }
+    if(fd >= 0 && (*p == '\0' || strcmp(p, ".") == 0 || strcmp(p, "..") == 0)) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+    *last = p;
+    return fd;
+}
+
+// the directory being collected, and where it goes on the host
+struct collect {
+    struct extract *ex;
+    char *path;
+    int depth;
+};
+
+int collect_entry(struct direntry *dirent, struct dir_pos *pos, void *arg) {
+    // Called for each entry of a directory: creates a subdirectory on the host straight
+    // away and collects what is in it, or queues a job for a file. follow_dir has
+    // already reported any orphaned long name slots.
+    struct collect *c = arg, sub;
+    struct extract *ex = c->ex;
+    struct dir_visitor v = {NULL, collect_entry, &sub, 0, NULL};
+    char hostpath[MAXPATHLEN + 1];
+    const char *last;
+    int dirfd, made;
+
+    entry_path(hostpath, sizeof(hostpath), c->path, dirent, &pos->lfn, ex->image_buf, ex->bpb);
+    if(dirent->deAttributes & ATTR_DIRECTORY) {
+        dirfd = open_parent(ex->rootfd, hostpath, &last);
+        made = dirfd >= 0 && (mkdirat(dirfd, last, 0755) == 0 || errno == EEXIST);
+        if(dirfd >= 0)
+            close(dirfd);
+        if(!made) {
+            fprintf(stderr, "Cannot create %s%s: %s\n", ex->dir, hostpath, strerror(errno));
+            ex->failed++;
+            return 0;
+        }
+        add_job(ex, hostpath, dirent, 1);
+        sub.ex = ex;
+        sub.path = hostpath;
+        sub.depth = c->depth + 1;
+        for_each_entry(getushort(dirent->deStartCluster), sub.depth, &v, ex->image_buf, ex->bpb);
+    } else {
+        add_job(ex, hostpath, dirent, 0);
+    }
+    return 0;
+}
+
+void *extract_worker(void *arg) {
+    // Takes file jobs off the list until there are none left
+    struct extract *ex = arg;
+    struct extract_job *job;
+    struct timespec times[2];
+    const char *last;
+    int j, dirfd, outfd;
+
+    while((j = __sync_fetch_and_add(&ex->next, 1)) < ex->njobs) {
+        job = &ex->jobs[j];
+        if(job->is_dir)
+            continue;
+        dirfd = open_parent(ex->rootfd, job->path, &last);
+        outfd = dirfd < 0 ? -1 : openat(dirfd, last, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW, 0644);
+        if(dirfd >= 0)
+            close(dirfd);
+        if(outfd < 0 || export_chain(ex->fd, ex->holes, job->start_cluster, job->size, outfd, ex->image_buf, ex->bpb) < 0) {
+            fprintf(stderr, "Cannot extract %s%s: %s\n", ex->dir, job->path, strerror(errno));
+            __sync_fetch_and_add(&ex->failed, 1);
+        }
+        if(outfd >= 0 && job->mtime >= 0) {
+            times[0].tv_sec = times[1].tv_sec = job->mtime;
+            times[0].tv_nsec = times[1].tv_nsec = 0;
+            futimens(outfd, times);
+        }
+        if(outfd >= 0)
+            close(outfd);
+    }
+    return NULL;
+}
+
+int extract_tree(char *dir, int fd, struct hole_map *holes, int nthreads, uint8_t *image_buf, struct bpb33 *bpb) {
+    // Rebuilds the image's directory tree under dir. All the directories are made
+    // first, then the file contents are copied by a pool of threads, and finally the
+    // directories get their DOS timestamps (copying files into them changes them).
+    // Returns the number of files and directories that failed.
+    struct extract ex;
+    struct timespec times[2];
+    pthread_t *threads;
+    const char *last;
+    int *started, t, j, dirfd;
+
+    memset(&ex, 0, sizeof(ex));
+    ex.fd = fd;
+    ex.holes = holes;
+    ex.image_buf = image_buf;
+    ex.bpb = bpb;
+    ex.dir = dir;
+    if((mkdir(dir, 0755) < 0 && errno != EEXIST) || (ex.rootfd = open(dir, O_RDONLY | O_DIRECTORY)) < 0) {
+        fprintf(stderr, "Cannot create %s: %s\n", dir, strerror(errno));
+        return 1;
+    }
+    struct collect top = {&ex, "", 0};
+    struct dir_visitor v = {NULL, collect_entry, &top, 0, NULL};
+    for_each_entry(MSDOSFSROOT, 0, &v, image_buf, bpb);
+
+    if(nthreads < 1)
+        nthreads = 1;
+    threads = malloc(nthreads * sizeof(pthread_t));
+    started = calloc(nthreads, sizeof(int));
+    for(t = 0; t < nthreads; t++)
+        started[t] = pthread_create(&threads[t], NULL, extract_worker, &ex) == 0;
+    extract_worker(&ex);  // help out, and make sure the work gets done even without threads
+    for(t = 0; t < nthreads; t++) {
+        if(started[t])
+            pthread_join(threads[t], NULL);
+    }
+
+    // nothing more will be written into the directories now
+    for(j = 0; j < ex.njobs; j++) {
+        if(ex.jobs[j].is_dir && ex.jobs[j].mtime >= 0 && (dirfd = open_parent(ex.rootfd, ex.jobs[j].path, &last)) >= 0) {
+            times[0].tv_sec = times[1].tv_sec = ex.jobs[j].mtime;
+            times[0].tv_nsec = times[1].tv_nsec = 0;
+            utimensat(dirfd, last, times, AT_SYMLINK_NOFOLLOW);
+            close(dirfd);
+        }
+        free(ex.jobs[j].path);
+    }
+    printf("Extracted %i files and directories to %s\n", ex.njobs, dir);
+
+    close(ex.rootfd);
+    free(ex.jobs);
+    free(started);
+    free(threads);
+    return ex.failed;
+}
@@ -0,0 +1,6 @@
+/* By: Bagus Maulana */
+
+/* prototypes for functions in extract.c */
+
+time_t dos_time(uint8_t *date, uint8_t *time);
+int extract_tree(char *dir, int fd, struct hole_map *holes, int nthreads, uint8_t *image_buf, struct bpb33 *bpb);
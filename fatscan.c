@@ -0,0 +1,172 @@
+/* By: Bagus Maulana */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "bootsect.h"
+#include "bpb.h"
+#include "direntry.h"
+#include "fat.h"
+#include "dos.h"
+#include "dos_scandisk.h"
+#include "memcap.h"
+#include "fatscan.h"
+
+// One thread's share of the FAT. Ranges start on a multiple of 64 clusters, so every
+// word of the bitsets (and every in-degree count inside the range) has a single writer.
+struct fat_range {
+    uint32_t first, last;        // clusters [first, last) belong to this thread
+    struct fat_summary *fs;
+    uint32_t *remote;            // targets of entries in the range that lie outside it
+    int nremote;
+    struct free_run *runs;
+    int nruns;
+    int nallocated, nbad, nfree, nbroken;
+    uint8_t *image_buf;
+    struct bpb33 *bpb;
+};
+
+void append_run(struct free_run **runs, int *n, uint32_t start, uint32_t len) {
+    // Adds a run of free clusters, joining it to the last one if they touch
+    if(*n && (*runs)[*n - 1].start + (*runs)[*n - 1].len == start) {
+        (*runs)[*n - 1].len += len;
+        return;
+    }
+    if(*n == 0 || (*n & (*n - 1)) == 0)
+        *runs = realloc(*runs, (*n ? 2 * *n : 1) * sizeof(struct free_run));
+    (*runs)[*n].start = start;
+    (*runs)[*n].len = len;
+    (*n)++;
+}
+
+void *analyse_range(void *arg) {
+    struct fat_range *r = arg;
+    struct fat_summary *fs = r->fs;
+    uint32_t c;
+    uint16_t entry;
+
+    uint8_t *fat = r->image_buf + r->bpb->bpbResSectors * r->bpb->bpbBytesPerSec;
+    uint32_t window = memory_cap ? memory_cap->window * 2 / 3 : 0, released = r->first;
+
+    for(c = r->first; c < r->last; c++) {
+        if(window && c - released >= window) {
+            // under --max-mem the FAT is decoded a window at a time
+            release_image(fat + 3 * released / 2, 3 * (c - released) / 2);
+            released = c;
+        }
+        entry = get_fat_entry(c, r->image_buf, r->bpb);
+        if(entry == CLUST_FREE) {
+            r->nfree++;
+            append_run(&r->runs, &r->nruns, c, 1);
+            continue;
+        }
+        if(entry == (FAT12_MASK & CLUST_BAD)) {
+            fs->bad[c / 64] |= (uint64_t) 1 << (c % 64);
+            r->nbad++;
+            continue;
+        }
+        fs->allocated[c / 64] |= (uint64_t) 1 << (c % 64);
+        r->nallocated++;
+        if(entry >= CLUST_FIRST && entry < fs->nclust) {
+            if(entry >= r->first && entry < r->last) {
+                if(fs->indegree[entry] < 255)
+                    fs->indegree[entry]++;
+            } else {
+                if(r->nremote == 0 || (r->nremote & (r->nremote - 1)) == 0)
+                    r->remote = realloc(r->remote, (r->nremote ? 2 * r->nremote : 1) * sizeof(uint32_t));
+                r->remote[r->nremote++] = entry;
+            }
+        } else if(entry < (FAT12_MASK & CLUST_EOFS)) {
+            r->nbroken++;
+        }
+    }
+    return NULL;
+}
+
+struct fat_summary *analyse_fat(int nthreads, uint8_t *image_buf, struct bpb33 *bpb) {
+    // Decodes the FAT once, one cluster range per thread, and merges what the ranges
+    // found: which clusters are allocated or bad, how many entries point at each cluster,
+    // and where the free space is.
+    struct fat_summary *fs = calloc(1, sizeof(struct fat_summary));
+    struct fat_range *ranges;
+    pthread_t *threads;
+    int *started;
+    uint32_t per_thread, c;
+    int t, k;
+
+    if(nthreads < 1)
+        nthreads = 1;
+    fs->nclust = num_clusters(bpb);
+    fs->allocated = capped_calloc((fs->nclust + 63) / 64, sizeof(uint64_t));
+    fs->bad = capped_calloc((fs->nclust + 63) / 64, sizeof(uint64_t));
+    fs->indegree = capped_calloc(fs->nclust, 1);
+    ranges = calloc(nthreads, sizeof(struct fat_range));
+    threads = malloc(nthreads * sizeof(pthread_t));
+    started = calloc(nthreads, sizeof(int));
+    per_thread = ((fs->nclust + nthreads - 1) / nthreads + 63) / 64 * 64;
+
+    for(t = 0; t < nthreads; t++) {
+        ranges[t].first = t * per_thread < CLUST_FIRST ? CLUST_FIRST : t * per_thread;
+        ranges[t].last = (t + 1) * per_thread < fs->nclust ? (t + 1) * per_thread : fs->nclust;
+        if(ranges[t].first >= ranges[t].last)
+            ranges[t].first = ranges[t].last;
+        ranges[t].fs = fs;
+        ranges[t].image_buf = image_buf;
+        ranges[t].bpb = bpb;
+        started[t] = pthread_create(&threads[t], NULL, analyse_range, &ranges[t]) == 0;
+        if(!started[t])
+            analyse_range(&ranges[t]);
+    }
+    for(t = 0; t < nthreads; t++) {
+        if(started[t])
+            pthread_join(threads[t], NULL);
+    }
+
+    // Merge the ranges in cluster order, so a free run cut by a range boundary is joined up
+    for(t = 0; t < nthreads; t++) {
+        struct fat_range *r = &ranges[t];
+        fs->nallocated += r->nallocated;
+        fs->nbad += r->nbad;
+        fs->nfree += r->nfree;
+        fs->nbroken += r->nbroken;
+        for(k = 0; k < r->nremote; k++) {
+            if(fs->indegree[r->remote[k]] < 255)
+                fs->indegree[r->remote[k]]++;
+        }
+        for(k = 0; k < r->nruns; k++)
+            append_run(&fs->runs, &fs->nruns, r->runs[k].start, r->runs[k].len);
+        free(r->remote);
+        free(r->runs);
+    }
+    for(k = 0; k < fs->nruns; k++) {
+        if(fs->runs[k].len > fs->largest_run)
+            fs->largest_run = fs->runs[k].len;
+    }
+    for(c = CLUST_FIRST; c < fs->nclust; c++)
+        fs->nshared += fs->indegree[c] > 1;
+
+    free(started);
+    free(threads);
+    free(ranges);
+    return fs;
+}
+
+int cluster_allocated(struct fat_summary *fs, uint32_t cluster) {
+    return cluster < fs->nclust && (fs->allocated[cluster / 64] >> (cluster % 64)) & 1;
+}
+
+int cluster_marked_bad(struct fat_summary *fs, uint32_t cluster) {
+    return cluster < fs->nclust && (fs->bad[cluster / 64] >> (cluster % 64)) & 1;
+}
+
+void free_fat_summary(struct fat_summary *fs) {
+    capped_free(fs->allocated);
+    capped_free(fs->bad);
+    capped_free(fs->indegree);
+    free(fs->runs);
+    free(fs);
+}
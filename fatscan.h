@@ -0,0 +1,27 @@
+/* By: Bagus Maulana */
+
+/* prototypes for functions in fatscan.c */
+
+struct free_run {
+    uint32_t start;
+    uint32_t len;
+};
+
+// what one pass over the whole FAT found
+struct fat_summary {
+    uint32_t nclust;
+    uint64_t *allocated;     // bitset of clusters in use (neither free nor marked bad)
+    uint64_t *bad;           // bitset of clusters marked bad
+    uint8_t *indegree;       // FAT entries pointing at each cluster, stopping at 255
+    int nallocated, nbad, nfree;
+    int nbroken;             // entries in use that point off the disk
+    int nshared;             // clusters more than one FAT entry points at
+    struct free_run *runs;   // runs of free clusters, in cluster order
+    int nruns;
+    uint32_t largest_run;
+};
+
+struct fat_summary *analyse_fat(int nthreads, uint8_t *image_buf, struct bpb33 *bpb);
+int cluster_allocated(struct fat_summary *fs, uint32_t cluster);
+int cluster_marked_bad(struct fat_summary *fs, uint32_t cluster);
+void free_fat_summary(struct fat_summary *fs);
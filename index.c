@@ -0,0 +1,367 @@
+/* By: Bagus Maulana */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "bootsect.h"
+#include "bpb.h"
+#include "direntry.h"
+#include "fat.h"
+#include "dos.h"
+#include "dos_scandisk.h"
+#include "checksum.h"
+#include "owner.h"
+#include "index.h"
+
+#define INDEX_MAGIC "FATIDX1"
+#define INDEX_VERSION 2
+
+int hash_image(char *imagename, uint64_t meta_len, uint32_t *meta_crc, uint32_t *crc, uint64_t *size, uint64_t *mtime) {
+    // The size and mtime of the image file, the CRC32C of its first meta_len bytes (the
+    // boot sector and FATs) and, unless crc is NULL, the CRC32C of the whole image. A
+    // scan's repairs are in the page cache already, so this sees them too.
+    struct stat st;
+    uint8_t *map;
+    int fd = open(imagename, O_RDONLY);
+
+    if(fd < 0 || fstat(fd, &st) < 0) {
+        if(fd >= 0)
+            close(fd);
+        return -1;
+    }
+    *size = st.st_size;
+    *mtime = (uint64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    *meta_crc = 0;
+    if(crc)
+        *crc = 0;
+    if(meta_len > *size)
+        meta_len = *size;
+    if(st.st_size) {
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if(map == MAP_FAILED) {
+            close(fd);
+            return -1;
+        }
+        *meta_crc = crc32c(0, map, meta_len);
+        if(crc)
+            *crc = crc32c(0, map, st.st_size);
+        munmap(map, st.st_size);
+    }
+    close(fd);
+    return 0;
+}
+
+uint64_t meta_length(uint16_t res_sectors, uint8_t fats, uint16_t fat_secs, uint16_t bytes_per_sec) {
+    // the boot sector (and any other reserved sectors) and the FATs
+    return ((uint64_t) res_sectors + (uint64_t) fats * fat_secs) * bytes_per_sec;
+}
+
+uint32_t section(uint32_t *off, uint32_t len) {
+    // Places a section of len bytes at *off, keeping every section 8 byte aligned
+    uint32_t start = *off;
+    *off = (start + len + 7) & ~7;
+    return start;
+}
+
+int write_section(FILE *fp, uint32_t off, void *p, size_t size, size_t n) {
+    if(fseek(fp, off, SEEK_SET) != 0 || (n && fwrite(p, size, n, fp) != n))
+        return -1;
+    return 0;
+}
+
+int write_scan_index(char *path, char *imagename, struct file *unref, int unrefctr, struct file *files, int filectr, uint8_t *image_buf, struct bpb33 *bpb) {
+    // Writes an index of the image as it is now (after any repairs): its geometry, FAT,
+    // files with their extents, and what this scan found. Returns 0 or -1.
+    struct owner_index *owners;
+    struct index_header h;
+    struct index_file *ifiles;
+    struct index_extent *extents = NULL;
+    struct index_finding *findings = calloc(unrefctr + filectr + 1, sizeof(struct index_finding));
+    int i, nextents = 0, capextents = 0, nfindings = 0, steps, status = 0;
+    uint16_t cluster;
+    uint32_t off;
+    char tmp[MAXPATHLEN + 10];
+    FILE *fp;
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    h.version = INDEX_VERSION;
+    if(hash_image(imagename, meta_length(bpb->bpbResSectors, bpb->bpbFATs, bpb->bpbFATsecs, bpb->bpbBytesPerSec),
+                  &h.meta_crc, &h.image_crc, &h.image_size, &h.image_mtime) < 0) {
+        fprintf(stderr, "Cannot read %s: %s\n", imagename, strerror(errno));
+        return -1;
+    }
+    owners = build_owner_index(image_buf, bpb);
+    ifiles = calloc(owners->nowners + 1, sizeof(struct index_file));
+    h.bytes_per_sec = bpb->bpbBytesPerSec;
+    h.res_sectors = bpb->bpbResSectors;
+    h.root_ents = bpb->bpbRootDirEnts;
+    h.sectors = bpb->bpbSectors;
+    h.fat_secs = bpb->bpbFATsecs;
+    h.sec_per_clust = bpb->bpbSecPerClust;
+    h.fats = bpb->bpbFATs;
+    h.nclust = owners->nclust;
+    h.nfiles = owners->nowners;
+    h.poolsize = owners->poolsize;
+
+    // each file's chain, as runs of clusters
+    for(i = 0; i < owners->nowners; i++) {
+        struct direntry *de = owners->des[i];
+        ifiles[i].parent = owners->parents[i];
+        ifiles[i].size = getulong(de->deFileSize);
+        ifiles[i].start_cluster = getushort(de->deStartCluster);
+        ifiles[i].mtime = getushort(de->deMTime);
+        ifiles[i].mdate = getushort(de->deMDate);
+        ifiles[i].attributes = de->deAttributes;
+        ifiles[i].first_extent = nextents;
+        cluster = ifiles[i].start_cluster;
+        for(steps = 0; steps < owners->nclust && cluster >= CLUST_FIRST && cluster < owners->nclust; steps++) {
+            if(nextents > ifiles[i].first_extent && extents[nextents - 1].start + extents[nextents - 1].len == cluster) {
+                extents[nextents - 1].len++;
+            } else {
+                if(nextents == capextents) {
+                    capextents = capextents ? 2 * capextents : 64;
+                    extents = realloc(extents, capextents * sizeof(struct index_extent));
+                }
+                extents[nextents].start = cluster;
+                extents[nextents].len = 1;
+                nextents++;
+            }
+            cluster = owners->fat[cluster];
+        }
+        ifiles[i].nextents = nextents - ifiles[i].first_extent;
+    }
+    h.nextents = nextents;
+
+    // what the scan found
+    for(i = 0; i < unrefctr + filectr; i++) {
+        struct file *f = i < unrefctr ? &unref[i] : &files[i - unrefctr];
+        if(i >= unrefctr && !f->oversized)
+            continue;
+        findings[nfindings].kind = i < unrefctr ? (f->is_dir ? FINDING_LOST_DIR : FINDING_LOST_FILE) : FINDING_OVERSIZED;
+        findings[nfindings].file = f->start_cluster < owners->nclust ? owners->owner[f->start_cluster] - 1 : -1;
+        findings[nfindings].start_cluster = f->start_cluster;
+        findings[nfindings].clusters = f->clusters;
+        findings[nfindings].size = f->size;
+        nfindings++;
+    }
+    h.nfindings = nfindings;
+
+    off = sizeof(h);
+    h.fat_off = section(&off, h.nclust * sizeof(uint16_t));
+    h.owner_off = section(&off, h.nclust * sizeof(uint16_t));
+    h.crossed_off = section(&off, h.nclust);
+    h.paths_off = section(&off, h.nfiles * sizeof(uint32_t));
+    h.files_off = section(&off, h.nfiles * sizeof(struct index_file));
+    h.extents_off = section(&off, h.nextents * sizeof(struct index_extent));
+    h.findings_off = section(&off, h.nfindings * sizeof(struct index_finding));
+    h.pool_off = section(&off, h.poolsize);
+
+    // written to a temporary file and renamed over the old index, so a reader never sees half of one
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    fp = fopen(tmp, "wb");
+    if(!fp) {
+        fprintf(stderr, "Cannot create %s: %s\n", tmp, strerror(errno));
+        status = -1;
+    } else {
+        if(write_section(fp, 0, &h, sizeof(h), 1) < 0
+           || write_section(fp, h.fat_off, owners->fat, sizeof(uint16_t), h.nclust) < 0
+           || write_section(fp, h.owner_off, owners->owner, sizeof(uint16_t), h.nclust) < 0
+           || write_section(fp, h.crossed_off, owners->crossed, 1, h.nclust) < 0
+           || write_section(fp, h.paths_off, owners->paths, sizeof(uint32_t), h.nfiles) < 0
+           || write_section(fp, h.files_off, ifiles, sizeof(struct index_file), h.nfiles) < 0
+           || write_section(fp, h.extents_off, extents, sizeof(struct index_extent), h.nextents) < 0
+           || write_section(fp, h.findings_off, findings, sizeof(struct index_finding), h.nfindings) < 0
+           || write_section(fp, h.pool_off, owners->pool, 1, h.poolsize) < 0)
+            status = -1;
+        if(fclose(fp) != 0)
+            status = -1;
+        if(status == 0 && rename(tmp, path) != 0)
+            status = -1;
+        if(status < 0) {
+            fprintf(stderr, "Cannot write %s: %s\n", path, strerror(errno));
+            unlink(tmp);
+        }
+    }
+
+    free(findings);
+    free(extents);
+    free(ifiles);
+    free_owner_index(owners);
+    return status;
+}
+
+int section_ok(struct scan_index *ix, uint32_t off, uint64_t len) {
+    return off >= sizeof(struct index_header) && off + len <= ix->len;
+}
+
+struct scan_index *open_scan_index(char *path, char *imagename) {
+    // Maps an index file, checking that it is whole and still describes the image.
+    // Returns NULL (saying why, unless there is no index at all) if it can't be used.
+    // The whole image is only hashed again when its size, mtime, boot sector or FATs
+    // differ from the index's; if it still matches, the index takes the new mtime.
+    struct scan_index *ix;
+    struct index_header *h;
+    struct stat st;
+    uint32_t crc, meta_crc;
+    uint64_t size, mtime, meta_len;
+    int i, ok, fd = open(path, O_RDONLY);
+
+    if(fd < 0) {
+        if(errno != ENOENT)
+            fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    if(fstat(fd, &st) < 0 || st.st_size < sizeof(struct index_header)) {
+        fprintf(stderr, "Index: %s is not an index file\n", path);
+        close(fd);
+        return NULL;
+    }
+    ix = calloc(1, sizeof(struct scan_index));
+    ix->len = st.st_size;
+    ix->map = mmap(NULL, ix->len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(ix->map == MAP_FAILED) {
+        fprintf(stderr, "Cannot map %s: %s\n", path, strerror(errno));
+        free(ix);
+        return NULL;
+    }
+    h = ix->h = ix->map;
+    if(memcmp(h->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0 || h->version != INDEX_VERSION
+       || !section_ok(ix, h->fat_off, (uint64_t) h->nclust * sizeof(uint16_t))
+       || !section_ok(ix, h->owner_off, (uint64_t) h->nclust * sizeof(uint16_t))
+       || !section_ok(ix, h->crossed_off, h->nclust)
+       || !section_ok(ix, h->paths_off, (uint64_t) h->nfiles * sizeof(uint32_t))
+       || !section_ok(ix, h->files_off, (uint64_t) h->nfiles * sizeof(struct index_file))
+       || !section_ok(ix, h->extents_off, (uint64_t) h->nextents * sizeof(struct index_extent))
+       || !section_ok(ix, h->findings_off, (uint64_t) h->nfindings * sizeof(struct index_finding))
+       || !section_ok(ix, h->pool_off, h->poolsize) || h->sec_per_clust == 0 || h->bytes_per_sec == 0) {
+        fprintf(stderr, "Index: %s is damaged or from another version\n", path);
+        close_scan_index(ix);
+        return NULL;
+    }
+    meta_len = meta_length(h->res_sectors, h->fats, h->fat_secs, h->bytes_per_sec);
+    ok = hash_image(imagename, meta_len, &meta_crc, NULL, &size, &mtime) == 0 && size == h->image_size;
+    if(ok && (mtime != h->image_mtime || meta_crc != h->meta_crc)) {
+        ok = hash_image(imagename, meta_len, &meta_crc, &crc, &size, &mtime) == 0 && size == h->image_size
+            && crc == h->image_crc;
+        fd = ok ? open(path, O_WRONLY) : -1;
+        if(fd >= 0) {
+            pwrite(fd, &mtime, sizeof(mtime), offsetof(struct index_header, image_mtime));  // or it is hashed again next time
+            close(fd);
+        }
+    }
+    if(!ok) {
+        fprintf(stderr, "Index: %s is out of date, %s has changed\n", path, imagename);
+        close_scan_index(ix);
+        return NULL;
+    }
+
+    ix->bpb.bpbBytesPerSec = h->bytes_per_sec;
+    ix->bpb.bpbSecPerClust = h->sec_per_clust;
+    ix->bpb.bpbResSectors = h->res_sectors;
+    ix->bpb.bpbFATs = h->fats;
+    ix->bpb.bpbRootDirEnts = h->root_ents;
+    ix->bpb.bpbSectors = h->sectors;
+    ix->bpb.bpbFATsecs = h->fat_secs;
+    ix->owners.nclust = h->nclust;
+    ix->owners.fat = (uint16_t *) ((uint8_t *) ix->map + h->fat_off);
+    ix->owners.owner = (uint16_t *) ((uint8_t *) ix->map + h->owner_off);
+    ix->owners.crossed = (uint8_t *) ix->map + h->crossed_off;
+    ix->owners.paths = (uint32_t *) ((uint8_t *) ix->map + h->paths_off);
+    ix->owners.nowners = h->nfiles;
+    ix->owners.pool = (char *) ix->map + h->pool_off;
+    ix->owners.poolsize = h->poolsize;
+    ix->files = (struct index_file *) ((uint8_t *) ix->map + h->files_off);
+    ix->extents = (struct index_extent *) ((uint8_t *) ix->map + h->extents_off);
+    ix->findings = (struct index_finding *) ((uint8_t *) ix->map + h->findings_off);
+
+    // the rest of the code trusts these, so check them once here
+    ok = h->poolsize ? ix->owners.pool[h->poolsize - 1] == '\0' : h->nfiles == 0;
+    for(i = 0; i < h->nclust && ok; i++)
+        ok = ix->owners.owner[i] <= h->nfiles;
+    for(i = 0; i < h->nfiles && ok; i++) {
+        ok = ix->owners.paths[i] < h->poolsize && ix->files[i].parent >= -1 && ix->files[i].parent < (int32_t) h->nfiles
+            && (uint64_t) ix->files[i].first_extent + ix->files[i].nextents <= h->nextents;
+    }
+    if(!ok) {
+        fprintf(stderr, "Index: %s is damaged\n", path);
+        close_scan_index(ix);
+        return NULL;
+    }
+    return ix;
+}
+
+void close_scan_index(struct scan_index *ix) {
+    munmap(ix->map, ix->len);
+    free(ix);
+}
+
+void index_list(struct scan_index *ix) {
+    // Lists every file and directory, like ls -lR
+    int i;
+    for(i = 0; i < ix->h->nfiles; i++) {
+        struct index_file *f = &ix->files[i];
+        printf("%10u %s%s\n", f->size, ix->owners.pool + ix->owners.paths[i], f->attributes & ATTR_DIRECTORY ? "/" : "");
+    }
+}
+
+int index_stat(struct scan_index *ix, char *path) {
+    // Prints everything the index knows about one file. Returns -1 if there is no such file.
+    struct index_file *f;
+    int i, e, clusters = 0;
+
+    for(i = 0; i < ix->h->nfiles; i++) {
+        if(strcmp(ix->owners.pool + ix->owners.paths[i], path) == 0)
+            break;
+    }
+    if(i == ix->h->nfiles) {
+        fprintf(stderr, "%s: no such file in the index\n", path);
+        return -1;
+    }
+    f = &ix->files[i];
+    for(e = 0; e < f->nextents; e++)
+        clusters += ix->extents[f->first_extent + e].len;
+    printf("Path: %s\n", path);
+    printf("Type: %s\n", f->attributes & ATTR_DIRECTORY ? "directory" : "file");
+    printf("Size: %u bytes in %i clusters (%u extents)\n", f->size, clusters, f->nextents);
+    printf("Attributes: 0x%02x\n", f->attributes);
+    printf("Modified: %04i-%02i-%02i %02i:%02i:%02i\n",
+           ((f->mdate & DD_YEAR_MASK) >> DD_YEAR_SHIFT) + 1980, (f->mdate & DD_MONTH_MASK) >> DD_MONTH_SHIFT,
+           (f->mdate & DD_DAY_MASK) >> DD_DAY_SHIFT, (f->mtime & DT_HOURS_MASK) >> DT_HOURS_SHIFT,
+           (f->mtime & DT_MINUTES_MASK) >> DT_MINUTES_SHIFT, ((f->mtime & DT_2SECONDS_MASK) >> DT_2SECONDS_SHIFT) * 2);
+    printf("Extents:");
+    for(e = 0; e < f->nextents; e++) {
+        struct index_extent *x = &ix->extents[f->first_extent + e];
+        if(x->len == 1)
+            printf(" %i", x->start);
+        else
+            printf(" %i-%i", x->start, x->start + x->len - 1);
+    }
+    printf("\n");
+    return 0;
+}
+
+void index_report(struct scan_index *ix) {
+    // Prints what the scan that wrote the index found (and fixed)
+    int i;
+    printf("Index: %u files, %u clusters, %u findings\n", ix->h->nfiles, ix->h->nclust, ix->h->nfindings);
+    for(i = 0; i < ix->h->nfindings; i++) {
+        struct index_finding *f = &ix->findings[i];
+        const char *path = f->file >= 0 && f->file < ix->h->nfiles ? ix->owners.pool + ix->owners.paths[f->file] : "?";
+        if(f->kind == FINDING_LOST_DIR)
+            printf("Lost directory: %u %u, now %s\n", f->start_cluster, f->clusters, path);
+        else if(f->kind == FINDING_LOST_FILE)
+            printf("Lost file: %u %u, now %s\n", f->start_cluster, f->clusters, path);
+        else if(f->kind == FINDING_OVERSIZED)
+            printf("%s %u %u\n", path, f->size, f->clusters * ix->h->bytes_per_sec * ix->h->sec_per_clust);
+    }
+}
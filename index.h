@@ -0,0 +1,70 @@
+/* By: Bagus Maulana */
+
+/* prototypes for functions in index.c */
+
+// The index file (<imagename>.idx) is a header followed by these sections, each at the
+// offset the header gives, so it can be used straight from an mmap.
+struct index_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t image_crc;         // CRC32C of the whole image the index describes
+    uint32_t meta_crc;          // CRC32C of its boot sector and FATs
+    uint64_t image_size;
+    uint64_t image_mtime;       // in ns; while it, the size and meta_crc match, image_crc isn't checked
+    // geometry
+    uint16_t bytes_per_sec, res_sectors, root_ents, sectors, fat_secs;
+    uint8_t sec_per_clust, fats;
+    uint32_t nclust, nfiles, nextents, nfindings, poolsize;
+    // section offsets
+    uint32_t fat_off;           // uint16_t per cluster: the decoded FAT
+    uint32_t owner_off;         // uint16_t per cluster: file id + 1, or 0
+    uint32_t crossed_off;       // uint8_t per cluster
+    uint32_t paths_off;         // uint32_t per file: offset of its path in the pool
+    uint32_t files_off;         // struct index_file per file
+    uint32_t extents_off;       // struct index_extent, grouped by file
+    uint32_t findings_off;      // struct index_finding
+    uint32_t pool_off;          // the paths, nul terminated
+};
+
+struct index_file {
+    int32_t parent;             // file id of its directory, or -1 for the root
+    uint32_t size;
+    uint16_t start_cluster;
+    uint16_t mtime, mdate;
+    uint8_t attributes;
+    uint8_t reserved;
+    uint32_t first_extent, nextents;
+};
+
+struct index_extent {
+    uint16_t start, len;
+};
+
+#define FINDING_LOST_FILE   1
+#define FINDING_LOST_DIR    2
+#define FINDING_OVERSIZED   3   // its chain was longer than its size, and has been cut
+
+struct index_finding {
+    uint32_t kind;
+    int32_t file;               // file id (lost files are in the root by now), or -1
+    uint32_t start_cluster, clusters, size;
+};
+
+// an index file mapped for queries
+struct scan_index {
+    void *map;
+    size_t len;
+    struct index_header *h;
+    struct bpb33 bpb;           // the geometry, for the functions in owner.c
+    struct owner_index owners;  // pointing into the map
+    struct index_file *files;
+    struct index_extent *extents;
+    struct index_finding *findings;
+};
+
+int write_scan_index(char *path, char *imagename, struct file *unref, int unrefctr, struct file *files, int filectr, uint8_t *image_buf, struct bpb33 *bpb);
+struct scan_index *open_scan_index(char *path, char *imagename);
+void close_scan_index(struct scan_index *ix);
+void index_list(struct scan_index *ix);
+int index_stat(struct scan_index *ix, char *path);
+void index_report(struct scan_index *ix);
@@ -0,0 +1,189 @@
+/* By: Bagus Maulana */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "bootsect.h"
+#include "bpb.h"
+#include "direntry.h"
+#include "fat.h"
+#include "dos.h"
+#include "dos_scandisk.h"
+#include "lfn.h"
+
+void lfn_orphan(struct lfn_run *run, FILE *report) {
+    fprintf(report, "LFN: %i orphaned long name slot%s at entry %i of directory %i\n",
+           run->slots, run->slots == 1 ? "" : "s", run->first, run->dir_cluster);
+}
+
+void lfn_slot(struct lfn_run *run, struct direntry *de, uint16_t dir_cluster, int idx, FILE *report) {
+    // Called by the directory walks for each long name slot. This only remembers where
+    // the run of slots is - the name is decoded later, and only if something needs it.
+    // Orphaned slots are reported to report, unless it is NULL.
+    struct winentry *we = (struct winentry *) de;
+
+    if(run->slots && !(we->weCnt & WIN_LAST) && run->dir_cluster == dir_cluster && run->first + run->slots == idx) {
+        run->slots++;  // the next slot of the current run
+        return;
+    }
+    if(run->slots && report)
+        lfn_orphan(run, report);  // a new run started before the last one reached its entry
+    run->dir_cluster = dir_cluster;
+    run->first = idx;
+    run->slots = 1;
+    if(!(we->weCnt & WIN_LAST)) {
+        // a run always starts with its last part, so this slot lost the ones before it
+        if(report)
+            lfn_orphan(run, report);
+        run->slots = 0;
+    }
+}
+
+struct lfn_run lfn_owner(struct lfn_run *run, struct direntry *de, FILE *report) {
+    // Called for every other entry (or with de NULL at the end of a directory). Returns
+    // the run that belongs to de, and starts over. Only files and subdirectories have
+    // long names, so slots before anything else are orphans.
+    struct lfn_run owned = *run;
+    run->slots = 0;
+    if(owned.slots && (!de || de->deName[0] == SLOT_DELETED || de->deName[0] == '.' || (de->deAttributes & ATTR_VOLUME))) {
+        if(report)
+            lfn_orphan(&owned, report);
+        owned.slots = 0;
+    }
+    return owned;
+}
+
+struct winentry *lfn_dir_entry(uint16_t dir_cluster, int idx, uint8_t *image_buf, struct bpb33 *bpb) {
+    // Finds entry idx of a directory, or returns NULL if the directory isn't that long
+    int per_cluster = bpb->bpbBytesPerSec * bpb->bpbSecPerClust / sizeof(struct direntry);
+    int nclust = num_clusters(bpb);
+
+    if(dir_cluster == MSDOSFSROOT)
+        return idx < bpb->bpbRootDirEnts ? (struct winentry *) root_dir_addr(image_buf, bpb) + idx : NULL;
+    while(idx >= per_cluster) {
+        dir_cluster = get_fat_entry(dir_cluster, image_buf, bpb);
+        if(dir_cluster < CLUST_FIRST || dir_cluster >= nclust)
+            return NULL;
+        idx -= per_cluster;
+    }
+    return (struct winentry *) cluster_to_addr(dir_cluster, image_buf, bpb) + idx;
+}
+
+uint8_t lfn_checksum(struct direntry *de) {
+    // The checksum of the 11 byte short name, which every slot of its long name carries
+    uint8_t sum = 0, *p = de->deName;
+    int i;
+    for(i = 0; i < 11; i++)
+        sum = ((sum & 1) << 7) + (sum >> 1) + p[i];
+    return sum;
+}
+
+int lfn_valid(struct lfn_run *run, struct direntry *de, uint8_t *image_buf, struct bpb33 *bpb) {
+    // Checks that the slots in run carry de's checksum and count down from the last part
+    // (which is stored first) to part 1.
+    struct winentry *we;
+    uint8_t sum;
+    int i;
+
+    if(!run->slots || run->slots > (WIN_MAXLEN + WIN_CHARS - 1) / WIN_CHARS)
+        return 0;
+    sum = lfn_checksum(de);
+    for(i = 0; i < run->slots; i++) {
+        we = lfn_dir_entry(run->dir_cluster, run->first + i, image_buf, bpb);
+        if(!we || we->weChksum != sum || (we->weCnt & WIN_CNT) != run->slots - i || !(we->weCnt & WIN_LAST) != (i > 0))
+            return 0;
+    }
+    return 1;
+}
+
+int put_utf8(char *buf, int out, int len, uint32_t c) {
+    // Appends c to buf as UTF-8 if there is room. Returns the new length.
+    if(c < 0x80 && out + 1 < len) {
+        buf[out++] = c;
+    } else if(c >= 0x80 && c < 0x800 && out + 2 < len) {
+        buf[out++] = 0xc0 | (c >> 6);
+        buf[out++] = 0x80 | (c & 0x3f);
+    } else if(c >= 0x800 && c < 0x10000 && out + 3 < len) {
+        buf[out++] = 0xe0 | (c >> 12);
+        buf[out++] = 0x80 | ((c >> 6) & 0x3f);
+        buf[out++] = 0x80 | (c & 0x3f);
+    } else if(c >= 0x10000 && out + 4 < len) {
+        buf[out++] = 0xf0 | (c >> 18);
+        buf[out++] = 0x80 | ((c >> 12) & 0x3f);
+        buf[out++] = 0x80 | ((c >> 6) & 0x3f);
+        buf[out++] = 0x80 | (c & 0x3f);
+    }
+    return out;
+}
+
+int lfn_name(struct lfn_run *run, struct direntry *de, char *buf, int len, uint8_t *image_buf, struct bpb33 *bpb) {
+    // Decodes de's long name into buf as UTF-8. Returns 1 if it has a valid long name and
+    // 0 otherwise. Characters that can't be in a host file name become '_'.
+    static const int offsets[WIN_CHARS] = {1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30};
+    uint16_t units[WIN_MAXLEN + WIN_CHARS];
+    struct winentry *we;
+    uint32_t c;
+    int i, k, n = 0, out = 0;
+
+    if(!lfn_valid(run, de, image_buf, bpb))
+        return 0;
+    // the slots are stored last part first
+    for(i = run->slots - 1; i >= 0; i--) {
+        we = lfn_dir_entry(run->dir_cluster, run->first + i, image_buf, bpb);
+        for(k = 0; k < WIN_CHARS; k++) {
+            uint8_t *p = (uint8_t *) we + offsets[k];
+            units[n++] = p[0] | (p[1] << 8);
+        }
+    }
+    for(i = 0; i < n && units[i] != 0x0000 && units[i] != 0xffff; i++) {
+        c = units[i];
+        if(c >= 0xd800 && c < 0xdc00 && i + 1 < n && units[i + 1] >= 0xdc00 && units[i + 1] < 0xe000)
+            c = 0x10000 + ((c - 0xd800) << 10) + (units[++i] - 0xdc00);  // surrogate pair
+        else if(c < 0x20 || c == '/' || (c >= 0xd800 && c < 0xe000))
+            c = '_';
+        out = put_utf8(buf, out, len, c);
+    }
+    buf[out] = '\0';
+    if(out == 0 || strcmp(buf, ".") == 0 || strcmp(buf, "..") == 0)
+        return 0;
+    return 1;
+}
+
+void short_host_name(char *buf, int len, const char *name, const char *ext) {
+    // NAME.EXT as one component of a host path, made safe the way lfn_name makes long
+    // names safe: '/' and control characters become '_', and a name that would be the
+    // directory itself or its parent (or nothing) becomes "_"
+    int i;
+    snprintf(buf, len, "%s%s%s", name, ext[0] ? "." : "", ext);
+    for(i = 0; buf[i]; i++)
+        if((unsigned char) buf[i] < 0x20 || buf[i] == '/')
+            buf[i] = '_';
+    if(buf[0] == '\0' || strcmp(buf, ".") == 0 || strcmp(buf, "..") == 0)
+        snprintf(buf, len, "_");
+}
+
+void file_display_name(struct file *f, char *buf, int len, uint8_t *image_buf, struct bpb33 *bpb) {
+    // The name to show for a file in reports: its long name if it has one, else NAME.EXT
+    if(!lfn_name(&f->lfn, f->de, buf, len, image_buf, bpb))
+        snprintf(buf, len, "%s.%s", f->name, f->ext);
+}
+
+int check_long_names(struct file *files, int filectr, uint8_t *image_buf, struct bpb33 *bpb) {
+    // Reports the files whose long name slots don't match them (a different checksum, or
+    // parts missing or out of order), and drops those long names. Only the checksums and
+    // sequence numbers are read; nothing is decoded. Returns the number of mismatches.
+    int i, mismatched = 0;
+    for(i = 0; i < filectr; i++) {
+        if(!files[i].lfn.slots || lfn_valid(&files[i].lfn, files[i].de, image_buf, bpb))
+            continue;
+        printf("LFN: %i long name slot%s at entry %i of directory %i don't match %s.%s\n",
+               files[i].lfn.slots, files[i].lfn.slots == 1 ? "" : "s", files[i].lfn.first,
+               files[i].lfn.dir_cluster, files[i].name, files[i].ext);
+        files[i].lfn.slots = 0;
+        mismatched++;
+    }
+    return mismatched;
+}
@@ -0,0 +1,13 @@
+/* By: Bagus Maulana */
+
+/* prototypes for functions in lfn.c */
+
+void lfn_orphan(struct lfn_run *run, FILE *report);
+void lfn_slot(struct lfn_run *run, struct direntry *de, uint16_t dir_cluster, int idx, FILE *report);
+struct lfn_run lfn_owner(struct lfn_run *run, struct direntry *de, FILE *report);
+uint8_t lfn_checksum(struct direntry *de);
+int lfn_valid(struct lfn_run *run, struct direntry *de, uint8_t *image_buf, struct bpb33 *bpb);
+int lfn_name(struct lfn_run *run, struct direntry *de, char *buf, int len, uint8_t *image_buf, struct bpb33 *bpb);
+void short_host_name(char *buf, int len, const char *name, const char *ext);
+void file_display_name(struct file *f, char *buf, int len, uint8_t *image_buf, struct bpb33 *bpb);
+int check_long_names(struct file *files, int filectr, uint8_t *image_buf, struct bpb33 *bpb);
@@ -0,0 +1,167 @@
+/* By: Bagus Maulana */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "bootsect.h"
+#include "bpb.h"
+#include "direntry.h"
+#include "fat.h"
+#include "dos.h"
+#include "memcap.h"
+
+struct mem_cap *memory_cap = NULL;
+
+void set_memory_cap(size_t limit, int overlay) {
+    // Half the limit may go on the heap, and the image is handed back in windows of an
+    // eighth of it (so a pass over the FAT or the data area never keeps more than that)
+    long page = sysconf(_SC_PAGESIZE);
+    memory_cap = calloc(1, sizeof(struct mem_cap));
+    memory_cap->limit = limit;
+    memory_cap->window = limit / 8 / page * page;
+    if(memory_cap->window < (size_t) page)
+        memory_cap->window = page;
+    memory_cap->dir = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+    memory_cap->overlay = overlay;
+    memory_cap->pagemap = overlay ? open("/proc/self/pagemap", O_RDONLY) : -1;
+}
+
+void *spill(size_t bytes) {
+    // A zeroed array in an unlinked temporary file, which the kernel can write out and
+    // drop from memory like any other file page
+    char path[MAXPATHLEN + 1];
+    void *p;
+    int fd;
+
+    snprintf(path, sizeof(path), "%s/scandisk-spill-XXXXXX", memory_cap->dir);
+    fd = mkstemp(path);
+    if(fd < 0)
+        return NULL;
+    unlink(path);
+    if(ftruncate(fd, bytes) < 0) {
+        close(fd);
+        return NULL;
+    }
+    p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+void *capped_calloc(size_t n, size_t size) {
+    // calloc, except that under --max-mem arrays that would take the heap past half the
+    // limit are put in spill files
+    size_t bytes = n * size;
+    void *p;
+
+    if(!memory_cap || memory_cap->heap + bytes <= memory_cap->limit / 2) {
+        if(memory_cap)
+            memory_cap->heap += bytes;
+        return calloc(n, size);
+    }
+    p = bytes ? spill(bytes) : NULL;
+    if(!p) {
+        fprintf(stderr, "Cannot spill %zu bytes to %s: %s\n", bytes, memory_cap->dir, strerror(errno));
+        memory_cap->heap += bytes;
+        return calloc(n, size);
+    }
+    if(memory_cap->nmaps == 0 || (memory_cap->nmaps & (memory_cap->nmaps - 1)) == 0) {
+        memory_cap->maps = realloc(memory_cap->maps, (memory_cap->nmaps ? 2 * memory_cap->nmaps : 1) * sizeof(void *));
+        memory_cap->sizes = realloc(memory_cap->sizes, (memory_cap->nmaps ? 2 * memory_cap->nmaps : 1) * sizeof(size_t));
+    }
+    memory_cap->maps[memory_cap->nmaps] = p;
+    memory_cap->sizes[memory_cap->nmaps] = bytes;
+    memory_cap->nmaps++;
+    memory_cap->spilled += bytes;
+    return p;
+}
+
+void capped_free(void *p) {
+    int i;
+    for(i = 0; memory_cap && i < memory_cap->nmaps; i++) {
+        if(memory_cap->maps[i] == p) {
+            munmap(p, memory_cap->sizes[i]);
+            memory_cap->maps[i] = memory_cap->maps[--memory_cap->nmaps];
+            memory_cap->sizes[i] = memory_cap->sizes[memory_cap->nmaps];
+            return;
+        }
+    }
+    free(p);
+}
+
+void *capped_grow(void *arr, int n, size_t size) {
+    // grow() for arrays from capped_calloc: makes room for element n, doubling the
+    // capacity when it is full. Under --max-mem the bigger array is placed like any
+    // other, so a table that outgrows the heap share moves to a spill file.
+    void *p;
+    int i;
+
+    if(n && (n & (n - 1)))
+        return arr;
+    if(!memory_cap)
+        return realloc(arr, (n ? 2 * n : 1) * size);
+    p = capped_calloc(n ? 2 * n : 1, size);
+    if(n)
+        memcpy(p, arr, n * size);
+    for(i = 0; i < memory_cap->nmaps && memory_cap->maps[i] != arr; i++)
+        ;
+    if(i == memory_cap->nmaps)
+        memory_cap->heap -= n * size;  // the old array was on the heap
+    capped_free(arr);
+    return p;
+}
+
+int file_page(uint64_t entry) {
+    // A /proc/self/pagemap entry for a page that is either not in memory at all or still
+    // the file's own page. A private copy that has been written to is anonymous: it is
+    // kept whether it is in memory (exclusive or not, bit 56) or swapped out (bit 62).
+    if(entry >> 62 & 1)
+        return 0;  // swapped, which only anonymous pages are
+    if(!(entry >> 63 & 1))
+        return 1;  // never read in, or the page cache can read it again
+    return (entry >> 61 & 1) != 0;
+}
+
+void release_image(uint8_t *addr, size_t len) {
+    // Hands the whole pages of [addr, addr + len) of the image mapping back to the
+    // kernel under --max-mem; the next access reads them in again. Pages of a shared
+    // mapping are only dropped from this process (the page cache keeps any changes).
+    // In a dry run's private mapping the pages the run has written to are the only copy
+    // of its changes, so only the pages pagemap says are still the file's are dropped.
+    long page = sysconf(_SC_PAGESIZE);
+    uintptr_t start = ((uintptr_t) addr + page - 1) / page * page, end = ((uintptr_t) addr + len) / page * page;
+    uintptr_t p, run = 0;
+    uint64_t entry;
+
+    if(!memory_cap || end <= start)
+        return;
+    if(!memory_cap->overlay) {
+        madvise((void *) start, end - start, MADV_DONTNEED);
+        return;
+    }
+    if(memory_cap->pagemap < 0) {
+        madvise((void *) start, end - start, MADV_PAGEOUT);  // best effort, swapped out not lost
+        return;
+    }
+    for(p = start; p <= end; p += page) {
+        if(p < end && pread(memory_cap->pagemap, &entry, sizeof(entry), p / page * sizeof(entry)) == sizeof(entry) && file_page(entry)) {
+            if(!run)
+                run = p;
+            continue;
+        }
+        if(run)
+            madvise((void *) run, p - run, MADV_DONTNEED);
+        run = 0;
+    }
+}
+
+void report_memory_cap(void) {
+    if(memory_cap)
+        printf("Memory: %zu KB on the heap, %zu KB spilled to %s, image released in %zu KB windows\n",
+               memory_cap->heap / 1024, memory_cap->spilled / 1024, memory_cap->dir, memory_cap->window / 1024);
+}
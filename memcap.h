@@ -0,0 +1,26 @@
+/* By: Bagus Maulana */
+
+/* prototypes for functions in memcap.c */
+
+// the memory a --max-mem scan may use
+struct mem_cap {
+    size_t limit;     // bytes of heap allowed before arrays go to spill files
+    size_t heap;      // bytes allocated on the heap
+    size_t spilled;   // bytes in spill files
+    size_t window;    // bytes of the image a pass keeps before handing them back
+    const char *dir;  // where spill files go
+    int overlay;      // the image is mapped privately (a dry run)
+    int pagemap;      // /proc/self/pagemap, to tell which private pages were written to
+    void **maps;      // the spilled arrays, so capped_free knows to unmap them
+    size_t *sizes;
+    int nmaps;
+};
+
+extern struct mem_cap *memory_cap;  // NULL unless --max-mem was given
+
+void set_memory_cap(size_t limit, int overlay);
+void *capped_calloc(size_t n, size_t size);
+void *capped_grow(void *arr, int n, size_t size);
+void capped_free(void *p);
+void release_image(uint8_t *addr, size_t len);
+void report_memory_cap(void);
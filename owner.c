@@ -0,0 +1,155 @@
+/* By: Bagus Maulana */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "bootsect.h"
+#include "bpb.h"
+#include "direntry.h"
+#include "fat.h"
+#include "dos.h"
+#include "dos_scandisk.h"
+#include "owner.h"
+#include "dirwalk.h"
+
+int add_owner(struct owner_index *idx, char *path, struct direntry *de, int parent) {
+    // Copies path into the pool and returns its new owner id
+    uint32_t len = strlen(path) + 1;
+    while(idx->poolsize + len > idx->poolcap) {
+        idx->poolcap = idx->poolcap ? 2 * idx->poolcap : 4096;
+        idx->pool = realloc(idx->pool, idx->poolcap);
+    }
+    if(idx->nowners == idx->capowners) {
+        idx->capowners = idx->capowners ? 2 * idx->capowners : 64;
+        idx->paths = realloc(idx->paths, idx->capowners * sizeof(uint32_t));
+        idx->des = realloc(idx->des, idx->capowners * sizeof(struct direntry *));
+        idx->parents = realloc(idx->parents, idx->capowners * sizeof(int));
+    }
+    memcpy(idx->pool + idx->poolsize, path, len);
+    idx->paths[idx->nowners] = idx->poolsize;
+    idx->des[idx->nowners] = de;
+    idx->parents[idx->nowners] = parent;
+    idx->poolsize += len;
+    return idx->nowners++;
+}
+
+void own_chain(struct owner_index *idx, int id, uint16_t cluster) {
+    int steps;
+    for(steps = 0; steps < idx->nclust && cluster >= CLUST_FIRST && cluster < idx->nclust; steps++) {
+        if(idx->owner[cluster] && idx->owner[cluster] != id + 1)
+            idx->crossed[cluster] = 1;
+        else
+            idx->owner[cluster] = id + 1;
+        cluster = idx->fat[cluster];
+    }
+}
+
+// the directory being indexed, and its path and owner id
+struct index_walk {
+    struct owner_index *idx;
+    char *path;
+    int parent;
+    int depth;
+    uint8_t *image_buf;
+    struct bpb33 *bpb;
+};
+
+int index_entry(struct direntry *dirent, struct dir_pos *pos, void *arg) {
+    // Called for each entry of a directory: gives the file or subdirectory an owner id
+    // and its clusters to that id, then indexes what is in a subdirectory.
+    struct index_walk *iw = arg, sub;
+    struct dir_visitor v = {NULL, index_entry, &sub, 0, NULL};
+    uint16_t start = getushort(dirent->deStartCluster);
+    char subpath[MAXPATHLEN + 1];
+    int id;
+
+    entry_path(subpath, sizeof(subpath), iw->path, dirent, &pos->lfn, iw->image_buf, iw->bpb);
+    id = add_owner(iw->idx, subpath, dirent, iw->parent);
+    own_chain(iw->idx, id, start);
+    if((dirent->deAttributes & ATTR_DIRECTORY) && start >= CLUST_FIRST && start < iw->idx->nclust) {
+        sub = *iw;
+        sub.path = subpath;
+        sub.parent = id;
+        sub.depth++;
+        for_each_entry(start, sub.depth, &v, iw->image_buf, iw->bpb);
+    }
+    return 0;
+}
+
+struct owner_index *build_owner_index(uint8_t *image_buf, struct bpb33 *bpb) {
+    // Builds the reverse index from clusters to the files using them. It takes a copy
+    // of the FAT, two bytes and a flag per cluster, plus the paths.
+    struct owner_index *idx = calloc(1, sizeof(struct owner_index));
+    struct index_walk top = {idx, "", -1, 0, image_buf, bpb};
+    struct dir_visitor v = {NULL, index_entry, &top, 0, NULL};
+    int c;
+    idx->nclust = num_clusters(bpb);
+    idx->fat = malloc(idx->nclust * sizeof(uint16_t));
+    idx->owner = calloc(idx->nclust, sizeof(uint16_t));
+    idx->crossed = calloc(idx->nclust, 1);
+    for(c = 0; c < idx->nclust; c++)
+        idx->fat[c] = get_fat_entry(c, image_buf, bpb);
+    for_each_entry(MSDOSFSROOT, 0, &v, image_buf, bpb);
+    return idx;
+}
+
+const char *cluster_owner(struct owner_index *idx, uint16_t cluster) {
+    // The path of the file using cluster, or NULL if none does
+    if(cluster >= idx->nclust || !idx->owner[cluster])
+        return NULL;
+    return idx->pool + idx->paths[idx->owner[cluster] - 1];
+}
+
+const char *sector_owner(struct owner_index *idx, uint32_t sector, int *cluster, struct bpb33 *bpb) {
+    // What a sector is used for: the path of a file, or one of the areas before the
+    // data area. Sets *cluster to the sector's cluster, or -1 if it isn't in the data area.
+    uint32_t fat_start = bpb->bpbResSectors, root_start = fat_start + bpb->bpbFATs * bpb->bpbFATsecs;
+    uint32_t data_start = root_start + bpb->bpbRootDirEnts * sizeof(struct direntry) / bpb->bpbBytesPerSec;
+
+    *cluster = -1;
+    if(sector < fat_start)
+        return "boot sector";
+    if(sector < root_start)
+        return "FAT";
+    if(sector < data_start)
+        return "root directory";
+    *cluster = (sector - data_start) / bpb->bpbSecPerClust + CLUST_FIRST;
+    return cluster_owner(idx, *cluster);
+}
+
+void print_sector_owner(struct owner_index *idx, uint32_t sector, struct bpb33 *bpb) {
+    int cluster;
+    const char *owner;
+    uint16_t entry;
+
+    if(sector >= bpb->bpbSectors) {
+        printf("Sector %u: past the end of the disk (%i sectors)\n", sector, bpb->bpbSectors);
+        return;
+    }
+    owner = sector_owner(idx, sector, &cluster, bpb);
+    if(cluster < 0) {
+        printf("Sector %u: %s\n", sector, owner);
+    } else if(cluster >= idx->nclust) {
+        printf("Sector %u: past the last cluster\n", sector);
+    } else if(owner) {
+        printf("Sector %u (cluster %i): %s%s\n", sector, cluster, owner, idx->crossed[cluster] ? " (cross-linked with another file)" : "");
+    } else {
+        entry = idx->fat[cluster];
+        printf("Sector %u (cluster %i): %s\n", sector, cluster,
+               entry == CLUST_FREE ? "free" : entry == (FAT12_MASK & CLUST_BAD) ? "marked bad" : "allocated but not in any file");
+    }
+}
+
+void free_owner_index(struct owner_index *idx) {
+    free(idx->fat);
+    free(idx->owner);
+    free(idx->crossed);
+    free(idx->paths);
+    free(idx->des);
+    free(idx->parents);
+    free(idx->pool);
+    free(idx);
+}
@@ -0,0 +1,23 @@
+/* By: Bagus Maulana */
+
+/* prototypes for functions in owner.c */
+
+// which file or directory owns each cluster, with every path stored once in a string pool
+struct owner_index {
+    int nclust;
+    uint16_t *fat;       // the decoded FAT
+    uint16_t *owner;     // per cluster: owner id + 1, or 0 if no file uses it
+    uint8_t *crossed;    // per cluster: used by more than one file
+    uint32_t *paths;     // per owner id: offset of its path in pool
+    struct direntry **des;  // per owner id: its direntry (only while the image is mapped)
+    int *parents;        // per owner id: the id of its directory, or -1 for the root
+    int nowners, capowners;
+    char *pool;
+    uint32_t poolsize, poolcap;
+};
+
+struct owner_index *build_owner_index(uint8_t *image_buf, struct bpb33 *bpb);
+const char *cluster_owner(struct owner_index *idx, uint16_t cluster);
+const char *sector_owner(struct owner_index *idx, uint32_t sector, int *cluster, struct bpb33 *bpb);
+void print_sector_owner(struct owner_index *idx, uint32_t sector, struct bpb33 *bpb);
+void free_owner_index(struct owner_index *idx);
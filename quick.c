@@ -0,0 +1,131 @@
+/* By: Bagus Maulana */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "bootsect.h"
+#include "bpb.h"
+#include "direntry.h"
+#include "fat.h"
+#include "dos.h"
+#include "dos_scandisk.h"
+#include "fatscan.h"
+#include "quick.h"
+
+#define QUICK_MAGIC "FATQCK1"
+
+/*
+ * The totals a clean full scan saw, saved in <imagename>.qck for the next
+ * quick scan. The geometry is there so that a sidecar left by a different
+ * image isn't trusted.
+ */
+struct quick_totals {
+    char magic[8];
+    int32_t sectors;
+    int32_t fat_secs;
+    int32_t tree_clusters;  // clusters used by the files and directories of the tree
+    int32_t bad_clusters;
+    int32_t files;
+};
+
+int fat_copy_differs(uint8_t *image_buf, struct bpb33 *bpb) {
+    // Returns the number (from 2) of the first backup FAT that doesn't match the first
+    // FAT, or 0 if they all do
+    uint32_t fat_bytes = bpb->bpbFATsecs * bpb->bpbBytesPerSec;
+    uint8_t *fat = image_buf + bpb->bpbResSectors * bpb->bpbBytesPerSec;
+    int i;
+    for(i = 1; i < bpb->bpbFATs; i++) {
+        if(memcmp(fat, fat + i * fat_bytes, fat_bytes) != 0)
+            return i + 1;
+    }
+    return 0;
+}
+
+int quick_check(char *path, char *why, int whylen, int nthreads, uint8_t *image_buf, struct bpb33 *bpb) {
+    // The first tier of --quick: decides from the FAT alone whether the disk is still
+    // as clean as the last full scan left it. Returns 1 if it is, and 0 (with the
+    // reason in why) if the full scan has to decide.
+    struct bootsector33 *bs = (struct bootsector33 *) image_buf;
+    uint8_t media = ((struct byte_bpb33 *) bs->bsBPB)->bpbMedia;
+    struct quick_totals q;
+    struct fat_summary *fs;
+    int copy, clean;
+    FILE *fp;
+
+    // the copies of the FAT have to agree
+    if((copy = fat_copy_differs(image_buf, bpb))) {
+        snprintf(why, whylen, "FAT copy %i differs from the first", copy);
+        return 0;
+    }
+
+    // the reserved entries hold the media byte and an end of chain mark
+    if(get_fat_entry(0, image_buf, bpb) != (0xf00 | media) || get_fat_entry(1, image_buf, bpb) < (FAT12_MASK & CLUST_EOFS)) {
+        snprintf(why, whylen, "bad reserved FAT entries");
+        return 0;
+    }
+
+    // and the clusters in use have to add up to what the tree used last time
+    fp = fopen(path, "rb");
+    if(!fp) {
+        snprintf(why, whylen, "no totals from an earlier clean scan");
+        return 0;
+    }
+    if(fread(&q, sizeof(q), 1, fp) != 1 || memcmp(q.magic, QUICK_MAGIC, sizeof(QUICK_MAGIC)) != 0
+       || q.sectors != bpb->bpbSectors || q.fat_secs != bpb->bpbFATsecs) {
+        fclose(fp);
+        snprintf(why, whylen, "%s doesn't belong to this image", path);
+        return 0;
+    }
+    fclose(fp);
+    fs = analyse_fat(nthreads, image_buf, bpb);
+    if(fs->nbroken)
+        snprintf(why, whylen, "%i FAT entries point off the disk", fs->nbroken);
+    else if(fs->nshared)
+        snprintf(why, whylen, "%i clusters are in more than one chain", fs->nshared);
+    else if(fs->nallocated != q.tree_clusters || fs->nbad != q.bad_clusters)
+        snprintf(why, whylen, "%i clusters allocated and %i bad, the tree used %i and %i were bad",
+                 fs->nallocated, fs->nbad, q.tree_clusters, q.bad_clusters);
+    else
+        snprintf(why, whylen, "%i clusters allocated, %i free, largest free run %u, %i bad, %i files",
+                 fs->nallocated, fs->nfree, fs->largest_run, fs->nbad, q.files);
+    clean = !fs->nbroken && !fs->nshared && fs->nallocated == q.tree_clusters && fs->nbad == q.bad_clusters;
+    free_fat_summary(fs);
+    return clean;
+}
+
+int save_quick_totals(char *path, int *visited, int filectr, int nthreads, uint8_t *image_buf, struct bpb33 *bpb) {
+    // Saves the totals of a clean full scan for the next quick scan. Returns 0 on success.
+    struct quick_totals q;
+    char tmp[MAXPATHLEN + 8];
+    struct fat_summary *fs;
+    int i;
+    FILE *fp;
+
+    memset(&q, 0, sizeof(q));
+    memcpy(q.magic, QUICK_MAGIC, sizeof(QUICK_MAGIC));
+    q.sectors = bpb->bpbSectors;
+    q.fat_secs = bpb->bpbFATsecs;
+    q.files = filectr;
+    for(i = CLUST_FIRST; i < num_clusters(bpb); i++)
+        q.tree_clusters += visited[i] != 0;
+    fs = analyse_fat(nthreads, image_buf, bpb);
+    q.bad_clusters = fs->nbad;
+    free_fat_summary(fs);
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    fp = fopen(tmp, "wb");
+    if(!fp) {
+        fprintf(stderr, "Cannot write %s: %s\n", tmp, strerror(errno));
+        return -1;
+    }
+    fwrite(&q, sizeof(q), 1, fp);
+    if(fclose(fp) != 0 || rename(tmp, path) != 0) {
+        fprintf(stderr, "Cannot write %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
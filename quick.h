@@ -0,0 +1,7 @@
+/* By: Bagus Maulana */
+
+/* prototypes for functions in quick.c */
+
+int fat_copy_differs(uint8_t *image_buf, struct bpb33 *bpb);
+int quick_check(char *path, char *why, int whylen, int nthreads, uint8_t *image_buf, struct bpb33 *bpb);
+int save_quick_totals(char *path, int *visited, int filectr, int nthreads, uint8_t *image_buf, struct bpb33 *bpb);
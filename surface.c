@@ -0,0 +1,234 @@
+/* By: Bagus Maulana */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "bootsect.h"
+#include "bpb.h"
+#include "direntry.h"
+#include "fat.h"
+#include "dos.h"
+#include "dos_scandisk.h"
+#include "surface.h"
+
+#define SURFACE_CHUNK (256 * 1024)  // bytes read per pread
+#define SURFACE_ALIGN 4096          // reads start and end on this boundary
+
+struct surface_range {
+    int fd;
+    off_t data_start;   // offset of cluster 2 in the image
+    off_t image_size;
+    int cluster_size;
+    struct hole_map *holes;  // unstored parts of the image read back as zeros, so they are skipped
+    uint16_t first, last;  // clusters [first, last) belong to this thread
+    uint8_t *bad;
+    int nbad;
+};
+
+off_t cluster_offset(uint16_t cluster, struct surface_range *r) {
+    return r->data_start + (off_t) (cluster - CLUST_FIRST) * r->cluster_size;
+}
+
+int read_fully(int fd, uint8_t *buf, size_t len, off_t off) {
+    // pread until len bytes have been read. Returns 0, or -1 with errno set on error.
+    while(len > 0) {
+        ssize_t n = pread(fd, buf, len, off);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n < 0)
+            return -1;
+        if(n == 0) {
+            errno = ENODATA;  // the image ends in the middle of the data area
+            return -1;
+        }
+        buf += n;
+        len -= n;
+        off += n;
+    }
+    return 0;
+}
+
+void *scan_range(void *arg) {
+    // Reads the clusters of one range in large aligned chunks. When a chunk fails
+    // it is read again one cluster at a time to find out which clusters are bad.
+    struct surface_range *r = arg;
+    int per_chunk = SURFACE_CHUNK / r->cluster_size;
+    uint8_t *buf;
+    uint16_t c, k;
+
+    if(per_chunk < 1)
+        per_chunk = 1;
+    if(posix_memalign((void **) &buf, SURFACE_ALIGN, SURFACE_CHUNK + 2 * SURFACE_ALIGN + r->cluster_size) != 0)
+        return NULL;
+
+    for(c = r->first; c < r->last; c += per_chunk) {
+        uint16_t end = c + per_chunk < r->last ? c + per_chunk : r->last;
+        off_t start = cluster_offset(c, r) & ~((off_t) SURFACE_ALIGN - 1);
+        off_t stop = (cluster_offset(end, r) + SURFACE_ALIGN - 1) & ~((off_t) SURFACE_ALIGN - 1);
+        if(stop > r->image_size)
+            stop = r->image_size;
+
+        if(is_hole(r->holes, start, stop - start))
+            continue;
+        if(stop > start && read_fully(r->fd, buf, stop - start, start) == 0)
+            continue;
+
+        for(k = c; k < end; k++) {
+            if(is_hole(r->holes, cluster_offset(k, r), r->cluster_size))
+                continue;
+            if(read_fully(r->fd, buf, r->cluster_size, cluster_offset(k, r)) < 0 && errno == EIO) {
+                r->bad[k] = 1;
+                r->nbad++;
+            }
+        }
+    }
+    free(buf);
+    return NULL;
+}
+
+int surface_scan(int fd, struct hole_map *holes, uint8_t *bad, int nthreads, uint8_t *image_buf, struct bpb33 *bpb) {
+    // Reads every data cluster from the image file, splitting the data area into one
+    // range per thread, and skipping the holes in a sparse image. Sets bad[cluster] for every cluster that couldn't be read and
+    // returns how many there were.
+    int nclust = num_clusters(bpb), per_thread, t, nbad = 0;
+    struct surface_range *ranges;
+    pthread_t *threads;
+    int *started;
+    struct stat statbuf;
+
+    if(fstat(fd, &statbuf) < 0) {
+        fprintf(stderr, "Cannot stat disk image: %s\n", strerror(errno));
+        exit(1);
+    }
+    if(nthreads < 1)
+        nthreads = 1;
+    ranges = calloc(nthreads, sizeof(struct surface_range));
+    threads = malloc(nthreads * sizeof(pthread_t));
+    started = calloc(nthreads, sizeof(int));
+    per_thread = (nclust - CLUST_FIRST + nthreads - 1) / nthreads;
+
+    for(t = 0; t < nthreads; t++) {
+        ranges[t].fd = fd;
+        ranges[t].data_start = cluster_to_addr(CLUST_FIRST, image_buf, bpb) - image_buf;
+        ranges[t].image_size = statbuf.st_size;
+        ranges[t].holes = holes;
+        ranges[t].cluster_size = bpb->bpbBytesPerSec * bpb->bpbSecPerClust;
+        ranges[t].first = CLUST_FIRST + t * per_thread;
+        ranges[t].last = ranges[t].first + per_thread < nclust ? ranges[t].first + per_thread : nclust;
+        ranges[t].bad = bad;
+        if(ranges[t].first >= ranges[t].last)
+            ranges[t].first = ranges[t].last;
+        started[t] = pthread_create(&threads[t], NULL, scan_range, &ranges[t]) == 0;
+        if(!started[t])
+            scan_range(&ranges[t]);  // couldn't start a thread, do it ourselves
+    }
+    for(t = 0; t < nthreads; t++) {
+        if(started[t])
+            pthread_join(threads[t], NULL);
+        nbad += ranges[t].nbad;
+    }
+
+    free(started);
+    free(threads);
+    free(ranges);
+    return nbad;
+}
+
+void report_zero_filled(struct hole_map *holes, struct file *files, int filectr, uint8_t *image_buf, struct bpb33 *bpb) {
+    // Reports files with clusters that lie in a hole of a sparse image. Those clusters
+    // are known to be all zeros without reading them.
+    int nclust = num_clusters(bpb), f, steps, zeros;
+    uint16_t c;
+
+    if(holes->n == 1 && holes->data[0].start == 0 && holes->data[0].end == holes->size)
+        return;  // not sparse
+
+    for(f = 0; f < filectr; f++) {
+        zeros = 0;
+        c = files[f].start_cluster;
+        for(steps = 0; steps < nclust && c >= CLUST_FIRST && c < nclust; steps++) {
+            if(cluster_is_hole(holes, c, image_buf, bpb))
+                zeros++;
+            c = get_fat_entry(c, image_buf, bpb);
+        }
+        if(zeros)
+            printf("Zero-filled: %s.%s %i of %i clusters\n", files[f].name, files[f].ext, zeros, files[f].clusters);
+    }
+}
+
+uint16_t find_free_cluster(uint8_t *bad, uint8_t *image_buf, struct bpb33 *bpb) {
+    // Returns the first free cluster that didn't fail the surface scan, or 0 if the disk is full
+    uint16_t c;
+    for(c = CLUST_FIRST; c < num_clusters(bpb); c++) {
+        if(!bad[c] && get_fat_entry(c, image_buf, bpb) == CLUST_FREE)
+            return c;
+    }
+    return 0;
+}
+
+void mark_bad_clusters(uint8_t *bad, int *visited, struct file *files, int filectr, uint8_t *image_buf, struct bpb33 *bpb) {
+    // Marks the clusters found by surface_scan as CLUST_BAD in the FAT. A bad cluster
+    // that belongs to a file is swapped out of the file's chain for a free cluster
+    // (its contents are lost, so the replacement is zero filled) and the file is reported,
+    // with how many of its clusters now read back as zeros.
+    // The replacement is marked in visited so the orphan sweep doesn't pick it up.
+    int nclust = num_clusters(bpb), cluster_size = bpb->bpbBytesPerSec * bpb->bpbSecPerClust;
+    uint16_t c, prev, next, spare;
+    int f, steps, zeroed;
+
+    for(f = 0; f < filectr; f++) {
+        zeroed = 0;
+        prev = 0;
+        c = files[f].start_cluster;
+        for(steps = 0; steps < nclust && c >= CLUST_FIRST && c < nclust; steps++) {
+            next = get_fat_entry(c, image_buf, bpb);
+            if(bad[c]) {
+                bad[c] = 0;
+                spare = find_free_cluster(bad, image_buf, bpb);
+                if(!spare) {
+                    printf("Bad cluster: %i in %s.%s (no free cluster to replace it)\n", c, files[f].name, files[f].ext);
+                } else {
+                    printf("Bad cluster: %i in %s.%s (replaced by %i)\n", c, files[f].name, files[f].ext, spare);
+                    memset(cluster_to_addr(spare, image_buf, bpb), 0, cluster_size);
+                    set_fat_entry(spare, next, image_buf, bpb);
+                    if(prev) {
+                        set_fat_entry(prev, spare, image_buf, bpb);
+                    } else {
+                        files[f].start_cluster = spare;
+                        putushort(files[f].de->deStartCluster, spare);
+                    }
+                    set_fat_entry(c, FAT12_MASK & CLUST_BAD, image_buf, bpb);
+                    visited[spare] = 1;
+                    c = spare;
+                    zeroed++;
+                }
+            }
+            if(is_end_of_file(next))
+                break;
+            prev = c;
+            c = next;
+        }
+        if(zeroed)
+            printf("Zero-filled: %s.%s %i of %i clusters (unreadable, contents lost)\n", files[f].name, files[f].ext, zeroed, files[f].clusters);
+    }
+
+    // whatever is left is either free, or used by a directory or a lost chain
+    for(c = CLUST_FIRST; c < nclust; c++) {
+        if(!bad[c])
+            continue;
+        bad[c] = 0;
+        if(get_fat_entry(c, image_buf, bpb) == CLUST_FREE) {
+            printf("Bad cluster: %i (free, marked bad)\n", c);
+            set_fat_entry(c, FAT12_MASK & CLUST_BAD, image_buf, bpb);
+        } else if(get_fat_entry(c, image_buf, bpb) != (FAT12_MASK & CLUST_BAD)) {
+            printf("Bad cluster: %i (in use outside any file, left alone)\n", c);
+        }
+    }
+    mirror_fat(image_buf, bpb);
+}
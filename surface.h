@@ -0,0 +1,7 @@
+/* By: Bagus Maulana */
+
+/* prototypes for functions in surface.c */
+
+int surface_scan(int fd, struct hole_map *holes, uint8_t *bad, int nthreads, uint8_t *image_buf, struct bpb33 *bpb);
+void report_zero_filled(struct hole_map *holes, struct file *files, int filectr, uint8_t *image_buf, struct bpb33 *bpb);
+void mark_bad_clusters(uint8_t *bad, int *visited, struct file *files, int filectr, uint8_t *image_buf, struct bpb33 *bpb);
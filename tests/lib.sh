@@ -0,0 +1,58 @@
+# Helpers for the regression tests. The images come from --build with its default
+# geometry (a 1.44 MB floppy): one reserved sector, two FATs of 9 sectors, 224 root
+# entries, one sector per cluster, and cluster 2 at sector 33.
+
+FAT1=512
+FAT2=5120
+ROOT=9728
+
+fail() {
+    echo "FAIL: $*"
+    exit 1
+}
+
+peek() {
+    # peek IMAGE OFFSET: the byte at OFFSET, in decimal
+    od -An -tu1 -j"$2" -N1 "$1" | tr -d ' '
+}
+
+poke() {
+    # poke IMAGE OFFSET BYTE...: overwrites bytes (given in decimal) from OFFSET
+    img=$1 off=$2
+    shift 2
+    for b; do printf "\\$(printf %03o "$b")"; done | dd of="$img" bs=1 seek="$off" conv=notrunc 2>/dev/null
+}
+
+poke_text() {
+    # poke_text IMAGE OFFSET TEXT
+    printf '%s' "$3" | dd of="$1" bs=1 seek="$2" conv=notrunc 2>/dev/null
+}
+
+cluster() {
+    # cluster N: the offset of data cluster N
+    echo $(((33 + $1 - 2) * 512))
+}
+
+root_entry() {
+    # root_entry N: the offset of root directory entry N
+    echo $((ROOT + 32 * $1))
+}
+
+set_fat() {
+    # set_fat IMAGE CLUSTER VALUE, in both FATs
+    for fat in $FAT1 $FAT2; do
+        off=$((fat + $2 * 3 / 2))
+        w=$(($(peek "$1" $off) | $(peek "$1" $((off + 1))) << 8))
+        if [ $(($2 % 2)) = 1 ]; then
+            w=$(((w & 0xf) | ($3 << 4)))
+        else
+            w=$(((w & 0xf000) | $3))
+        fi
+        poke "$1" $off $((w & 255)) $((w >> 8))
+    done
+}
+
+move_cluster() {
+    # move_cluster IMAGE FROM TO: copies a cluster's contents (the FAT is left alone)
+    dd if="$1" of="$1" bs=512 skip=$((33 + $2 - 2)) seek=$((33 + $3 - 2)) count=1 conv=notrunc 2>/dev/null
+}
@@ -0,0 +1,21 @@
+#!/bin/sh
+# Runs every tests/t_*.sh in a scratch directory of its own (make test). A test exits
+# non-zero on failure, and its output is shown then.
+
+TESTS=$(cd "$(dirname "$0")" && pwd)
+SCANDISK=${SCANDISK:-$TESTS/../dos_scandisk}
+export TESTS SCANDISK
+failed=0
+
+for t in "$TESTS"/t_*.sh; do
+    dir=$(mktemp -d "${TMPDIR:-/tmp}/scandisk-test-XXXXXX")
+    if (cd "$dir" && sh "$t") > "$dir.log" 2>&1; then
+        echo "ok   $(basename "$t")"
+    else
+        echo "FAIL $(basename "$t")"
+        sed 's/^/    /' "$dir.log"
+        failed=$((failed + 1))
+    fi
+    rm -rf "$dir" "$dir.log"
+done
+[ $failed = 0 ]
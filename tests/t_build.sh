@@ -0,0 +1,31 @@
+# --build makes an image a scan finds clean and --extract gives back unchanged, with
+# short names generated for long ones that don't clash with their siblings
+. "$TESTS/lib.sh"
+
+mkdir -p tree/SUB/DEEP "tree/Another folder"
+echo one > "tree/Long File Name One.txt"
+echo two > "tree/Long File Name Two.txt"
+echo taken > tree/LONGFI~1.TXT
+echo spaced > "tree/B B"
+echo real > tree/BB~1  # the short name "B B" would get if only earlier names were checked
+echo lower > tree/lower.txt
+head -c 20000 /dev/urandom > tree/SUB/DATA.BIN
+echo deep > tree/SUB/DEEP/D.TXT
+: > "tree/Another folder/empty file"
+$SCANDISK --build tree b.img > out || fail "build exited $?"
+grep -q "0 left out" out || fail "files left out: $(cat out)"
+i=0
+while [ "$(peek b.img $(root_entry $i))" != 0 ]; do
+    off=$(root_entry $i)
+    if [ "$(peek b.img $((off + 11)))" != 15 ]; then  # not a long name slot
+        dd if=b.img bs=1 skip=$off count=11 2>/dev/null
+        echo
+    fi
+    i=$((i + 1))
+done > names
+[ -z "$(sort names | uniq -d)" ] || fail "short names used twice: $(sort names | uniq -d)"
+
+$SCANDISK b.img > out || fail "scan exited $?"
+grep -v '^$' out && fail "built image not clean"
+$SCANDISK --extract x b.img > /dev/null || fail "extract"
+diff -r tree x || fail "extracted tree differs"
@@ -0,0 +1,17 @@
+# A lost file is named after its type, and a two letter extension is space padded so
+# the entry stays valid
+. "$TESTS/lib.sh"
+
+mkdir tree
+printf '\037\213\010\000' > tree/A.GZ
+head -c 1000 /dev/urandom >> tree/A.GZ
+echo hi > tree/B.TXT
+$SCANDISK --build tree c.img > /dev/null || fail "build"
+poke c.img $(root_entry 0) 229  # delete A.GZ's entry
+
+$SCANDISK c.img > out || fail "scan exited $?"
+grep -q "^Lost file: 2 2 (GZ" out || fail "A.GZ not classified as GZ"
+$SCANDISK c.img > out || fail "rescan exited $?"
+grep -v '^$' out && fail "rescan not clean"
+$SCANDISK --extract x c.img > /dev/null || fail "extract"
+head -c 1004 x/FOUND1.GZ | cmp - tree/A.GZ || fail "FOUND1.GZ differs"  # it is a whole number of clusters long
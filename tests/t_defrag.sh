@@ -0,0 +1,27 @@
+# --defrag makes a fragmented file contiguous without changing it, and leaves a file
+# with a broken chain where it is
+. "$TESTS/lib.sh"
+
+mkdir tree
+for f in A B C; do head -c 1500 /dev/urandom > tree/$f.BIN; done
+$SCANDISK --build tree d.img > /dev/null || fail "build"
+
+# A is clusters 2-4: move its middle cluster to 20
+move_cluster d.img 3 20
+set_fat d.img 2 20
+set_fat d.img 20 4
+set_fat d.img 3 0
+cp d.img broken.img
+
+$SCANDISK --defrag d.img > out || fail "defrag exited $?"
+grep -q "^Defrag: A.BIN 3 clusters -> 2-4 (1 moved)" out || fail "A.BIN not planned back to 2-4"
+$SCANDISK --extract x d.img > /dev/null || fail "extract"
+diff -r tree x || fail "defrag changed the files"
+
+# C is clusters 8-10: point its second cluster past the end of the disk
+set_fat broken.img 9 4000
+$SCANDISK --defrag broken.img > out
+grep -q "^Defrag: C.BIN has a broken cluster chain, left where it is" out || fail "broken chain not reported"
+grep -q "^Defrag: A.BIN 3 clusters -> 2-4" out || fail "A.BIN not relocated"
+$SCANDISK --extract y broken.img > /dev/null
+cmp tree/A.BIN y/A.BIN || fail "A.BIN changed"
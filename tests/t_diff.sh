@@ -0,0 +1,31 @@
+# --diff reports the files that differ between two images of the same volume, and only
+# those
+. "$TESTS/lib.sh"
+
+mkdir -p tree/SUB
+echo aaa > tree/A.TXT
+head -c 2000 /dev/urandom > tree/C.BIN
+echo bbb > tree/SUB/B.TXT
+$SCANDISK --build tree a.img > /dev/null || fail "build"
+
+cp a.img b.img
+$SCANDISK --diff a.img b.img > out || fail "identical images: exited $?"
+grep -q "^Files: 0 added, 0 removed, 0 modified" out || fail "identical images differ"
+
+# one byte in the second cluster of C.BIN (clusters 3-6)
+poke b.img $(($(cluster 4) + 10)) 88
+$SCANDISK --diff a.img b.img > out
+[ $? = 2 ] || fail "changed image: expected exit 2"
+[ "$(grep '^Modified' out)" = "Modified: /C.BIN" ] || fail "expected only C.BIN modified: $(cat out)"
+
+# an image built from a changed copy of the tree
+cp -r tree tree2
+rm tree2/A.TXT
+echo new > tree2/D.TXT
+echo BBB > tree2/SUB/B.TXT
+$SCANDISK --build tree2 c.img > /dev/null || fail "build"
+$SCANDISK --diff a.img c.img > out
+[ $? = 2 ] || fail "rebuilt image: expected exit 2"
+grep -q "^Removed: /A.TXT" out || fail "A.TXT not removed"
+grep -q "^Added: /D.TXT" out || fail "D.TXT not added"
+grep -q "^Modified: /SUB/B.TXT" out || fail "SUB/B.TXT not modified"
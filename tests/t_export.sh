@@ -0,0 +1,16 @@
+# --export-all writes every file into the export directory, even when a name in the
+# image has path separators or dots in it
+. "$TESTS/lib.sh"
+
+mkdir tree
+echo one > tree/A.TXT
+echo two > tree/B.TXT
+$SCANDISK --build tree e.img > /dev/null || fail "build"
+poke_text e.img $(root_entry 0) "../../PWTXT"
+
+mkdir -p a/b/out
+$SCANDISK --export a/b/out --export-all e.img > /dev/null || fail "export exited $?"
+[ -f a/b/out/.._.._PW.TXT ] || fail "../../PW.TXT not exported under a safe name"
+cmp tree/A.TXT a/b/out/.._.._PW.TXT || fail "wrong contents"
+cmp tree/B.TXT a/b/out/B.TXT || fail "B.TXT not exported"
+[ "$(find . -name '*PW*' | wc -l)" = 1 ] || fail "a file was written outside the export directory"
@@ -0,0 +1,25 @@
+# --extract copies the whole tree out unchanged, and keeps names that would climb out of
+# the output directory inside it
+. "$TESTS/lib.sh"
+
+mkdir -p tree/SUB/DEEP "tree/Long name folder"
+head -c 5000 /dev/urandom > tree/DATA.BIN
+echo hello > "tree/A file with a long name.txt"
+echo nested > tree/SUB/DEEP/N.TXT
+echo spaced > "tree/Long name folder/inside.txt"
+: > tree/SUB/EMPTY.TXT
+$SCANDISK --build tree x.img > /dev/null || fail "build"
+$SCANDISK --extract out x.img > /dev/null || fail "extract exited $?"
+diff -r tree out || fail "extracted tree differs"
+
+mkdir bad
+echo one > bad/A.TXT
+echo two > bad/B.TXT
+$SCANDISK --build bad t.img > /dev/null || fail "build"
+poke_text t.img $(root_entry 0) "../../PWTXT"
+poke_text t.img $(root_entry 1) "..      TXT"
+mkdir -p a/b
+$SCANDISK --extract a/b/x t.img > /dev/null || fail "extract exited $?"
+[ -f a/b/x/.._.._PW.TXT ] || fail "../../PW.TXT not extracted under a safe name"
+[ "$(find . -name '*PW*' | wc -l)" = 1 ] || fail "a file was written outside the output directory"
+[ "$(ls a)" = b ] && [ "$(ls a/b)" = x ] || fail "files written next to the output directory"
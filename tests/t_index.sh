@@ -0,0 +1,21 @@
+# Queries use the index while the image is unchanged (a touch doesn't count), and
+# refuse it once the contents change
+. "$TESTS/lib.sh"
+
+mkdir -p tree/SUB
+head -c 2000 /dev/urandom > tree/C.BIN
+echo bbb > tree/SUB/B.TXT
+$SCANDISK --build tree i.img > /dev/null || fail "build"
+$SCANDISK --index i.img > out || fail "index scan exited $?"
+
+$SCANDISK --who-owns 34 i.img > out 2> err || fail "who-owns exited $?"
+grep -q "^Sector 34 (cluster 3): /C.BIN" out || fail "wrong owner: $(cat out)"
+[ -s err ] && fail "index not used: $(cat err)"
+touch i.img
+$SCANDISK --ls i.img > out 2> err || fail "ls exited $?"
+grep -q "SUB/B.TXT" out || fail "ls: $(cat out)"
+[ -s err ] && fail "index not used after a touch: $(cat err)"
+
+poke i.img $(($(cluster 3) + 10)) 88
+$SCANDISK --ls i.img > out 2> err
+grep -q "out of date" err || fail "changed image not noticed"
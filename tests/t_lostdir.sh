@@ -0,0 +1,19 @@
+# A lost directory with more files than the file table first has room for is reattached
+# whole, and a scan after that finds it clean
+. "$TESTS/lib.sh"
+
+mkdir -p tree/D
+i=1
+while [ $i -le 1200 ]; do
+    echo $i > tree/D/F$i.TXT
+    i=$((i + 1))
+done
+$SCANDISK --build tree l.img > /dev/null || fail "build"
+poke l.img $(root_entry 0) 229  # delete D's entry
+
+$SCANDISK l.img > out || fail "scan exited $?"
+grep -q "^Lost directory: 2 " out || fail "D not found as a lost directory"
+$SCANDISK l.img > out || fail "rescan exited $?"
+grep -q "Lost" out && fail "still lost after the repair"
+$SCANDISK --extract x l.img > /dev/null || fail "extract"
+diff -r tree/D x/FOUND.000 || fail "FOUND.000 differs from D"
@@ -0,0 +1,25 @@
+# --undelete brings back deleted files whose clusters are still free, in the root and in
+# a subdirectory, with the first letter of the name lost
+. "$TESTS/lib.sh"
+
+mkdir -p tree/SUB
+head -c 3000 /dev/urandom > tree/BIG.BIN
+echo keep > tree/KEEP.TXT
+echo inner > tree/SUB/INNER.TXT
+$SCANDISK --build tree u.img > /dev/null || fail "build"
+
+# delete BIG.BIN (clusters 2-7) and SUB/INNER.TXT (cluster 10) the way DOS does
+poke u.img $(root_entry 0) 229
+for c in 2 3 4 5 6 7; do set_fat u.img $c 0; done
+poke u.img $(($(cluster 9) + 64)) 229
+set_fat u.img 10 0
+$SCANDISK u.img > out || fail "scan of the deleted files exited $?"
+
+$SCANDISK --undelete u.img > out || fail "undelete exited $?"
+grep -q "^Undelete: 2 of 2 deleted files recovered" out || fail "not both files recovered"
+$SCANDISK u.img > out || fail "rescan exited $?"
+grep -v '^$' out && fail "rescan not clean"
+$SCANDISK --extract x u.img > /dev/null || fail "extract"
+cmp tree/BIG.BIN x/_IG.BIN || fail "BIG.BIN not recovered"
+cmp tree/SUB/INNER.TXT x/SUB/_NNER.TXT || fail "SUB/INNER.TXT not recovered"
+cmp tree/KEEP.TXT x/KEEP.TXT || fail "KEEP.TXT changed"
@@ -0,0 +1,17 @@
+# The repairs of the sample images are checked afterwards and found consistent, and a
+# scan after them finds nothing left to repair
+. "$TESTS/lib.sh"
+
+for n in badfloppy1 badfloppy2; do
+    cp "$TESTS/../$n.img" v.img
+    $SCANDISK v.img > out || fail "$n: scan exited $?"
+    grep -q "^Verify: .* consistent$" out || fail "$n: repairs not verified: $(grep Verify out)"
+    $SCANDISK v.img > out || fail "$n: rescan exited $?"
+    grep -v '^$' out && fail "$n: rescan not clean"
+
+    # a dry run checks the same repairs without writing them
+    cp "$TESTS/../$n.img" v.img
+    $SCANDISK --dry-run v.img > out || fail "$n: dry run exited $?"
+    grep -q "^Verify: .* consistent$" out || fail "$n: dry run repairs not verified"
+    cmp "$TESTS/../$n.img" v.img || fail "$n: dry run changed the image"
+done
@@ -0,0 +1,38 @@
+# Every walk keeps every file of a volume with more files than the file table first has
+# room for: the last of 1200 files has a chain longer than its size, and each walk finds it
+. "$TESTS/lib.sh"
+
+mkdir -p tree/D
+i=1
+while [ $i -le 1200 ]; do
+    echo $i > tree/D/F$i.TXT
+    i=$((i + 1))
+done
+$SCANDISK --build tree w.img > /dev/null || fail "build"
+
+# D is contiguous from cluster 2; its last entry (after . and ..) is F999.TXT
+entry=$(($(cluster 2) + 1201 * 32))
+start=$(($(peek w.img $((entry + 26))) | $(peek w.img $((entry + 27))) << 8))
+set_fat w.img $start 2000
+set_fat w.img 2000 4095
+
+for opts in "" "--threads 4" "--incremental" "--max-mem 1"; do
+    cp w.img t.img
+    $SCANDISK $opts t.img > out || fail "scan with '$opts' exited $?"
+    grep -q "^F999.TXT 4 1024$" out || fail "scan with '$opts' missed the last file"
+done
+
+# --undelete walks the whole tree too, and finds the last file once it is deleted
+cp w.img t.img
+poke t.img $entry 229
+set_fat t.img $start 0
+set_fat t.img 2000 0
+$SCANDISK --undelete t.img > out || fail "undelete exited $?"
+grep -q "^Undelete: 1 of 1 deleted files recovered" out || fail "the last file not undeleted"
+
+# an incremental scan that reuses the whole checkpoint still has them all
+cp w.img t.img
+$SCANDISK t.img > /dev/null
+$SCANDISK --incremental t.img > /dev/null || fail "incremental scan exited $?"
+$SCANDISK --incremental t.img > out || fail "second incremental scan exited $?"
+grep -q "(1200 files)" out || fail "checkpoint lost files: $(cat out)"
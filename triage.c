@@ -0,0 +1,133 @@
+/* By: Bagus Maulana */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "bootsect.h"
+#include "bpb.h"
+#include "direntry.h"
+#include "fat.h"
+#include "dos.h"
+#include "dos_scandisk.h"
+#include "triage.h"
+
+#define FAT12_MAX_CLUSTERS 4084
+
+int power_of_two(unsigned int n) {
+    return n && !(n & (n - 1));
+}
+
+int junk(char *why, int whylen, const char *reason) {
+    snprintf(why, whylen, "%s", reason);
+    return TRIAGE_JUNK;
+}
+
+int triage_image(char *imagename, char *why, int whylen) {
+    // Decides from the boot sector and the first FAT sector alone (two preads, no
+    // mapping) whether an image is a FAT12 file system this program can work on. Junk
+    // would send the scan outside the image; a repairable image has a sound layout but
+    // a damaged boot sector signature, media byte or reserved FAT entries. why gets the
+    // reason for anything but TRIAGE_VALID.
+    uint8_t boot[512], fat[3];
+    struct bootsector33 *bs = (struct bootsector33 *) boot;
+    struct byte_bpb33 *b = (struct byte_bpb33 *) bs->bsBPB;
+    struct stat st;
+    uint32_t bps, spc, res, nfats, rootents, sectors, fatsecs, rootsecs, datastart, clusters;
+    uint8_t media;
+    uint16_t fat0, fat1;
+    int fd = open(imagename, O_RDONLY), result = TRIAGE_VALID;
+
+    why[0] = '\0';
+    if(fd < 0 || fstat(fd, &st) < 0) {
+        snprintf(why, whylen, "cannot read: %s", strerror(errno));
+        if(fd >= 0)
+            close(fd);
+        return TRIAGE_JUNK;
+    }
+    if(pread(fd, boot, sizeof(boot), 0) != sizeof(boot)) {
+        close(fd);
+        return junk(why, whylen, "shorter than a boot sector");
+    }
+
+    bps = getushort(b->bpbBytesPerSec);
+    spc = (uint8_t) b->bpbSecPerClust;
+    res = getushort(b->bpbResSectors);
+    nfats = (uint8_t) b->bpbFATs;
+    rootents = getushort(b->bpbRootDirEnts);
+    sectors = getushort(b->bpbSectors);
+    media = b->bpbMedia;
+    fatsecs = getushort(b->bpbFATsecs);
+
+    // the layout has to make sense, or the scan would run off the end of the mapping
+    if(!power_of_two(bps) || bps < 512 || bps > 4096) {
+        close(fd);
+        return junk(why, whylen, "bytes per sector is not a power of two from 512 to 4096");
+    }
+    if(!power_of_two(spc) || spc > 128) {
+        close(fd);
+        return junk(why, whylen, "sectors per cluster is not a power of two up to 128");
+    }
+    if(res < 1 || nfats < 1 || nfats > 4 || fatsecs < 1 || rootents < 1 || (rootents * sizeof(struct direntry)) % bps) {
+        close(fd);
+        return junk(why, whylen, "impossible reserved sector, FAT or root directory counts");
+    }
+    if(sectors == 0) {
+        close(fd);
+        return junk(why, whylen, "more than 65535 sectors, so not FAT12");
+    }
+    rootsecs = rootents * sizeof(struct direntry) / bps;
+    datastart = res + nfats * fatsecs + rootsecs;
+    if(datastart >= sectors) {
+        close(fd);
+        return junk(why, whylen, "no room for a data area");
+    }
+    clusters = (sectors - datastart) / spc;
+    if(clusters > FAT12_MAX_CLUSTERS) {
+        close(fd);
+        return junk(why, whylen, "too many clusters for FAT12");
+    }
+    if((clusters + CLUST_FIRST) * 3 / 2 > fatsecs * bps) {
+        close(fd);
+        return junk(why, whylen, "the FAT is too small for the clusters");
+    }
+    if((off_t) sectors * bps > st.st_size) {
+        close(fd);
+        return junk(why, whylen, "the file system is bigger than the image file");
+    }
+
+    // now the parts a repair can put right
+    if(pread(fd, fat, sizeof(fat), (off_t) res * bps) != sizeof(fat)) {
+        close(fd);
+        return junk(why, whylen, "cannot read the FAT");
+    }
+    close(fd);
+    fat0 = fat[0] | ((fat[1] & 0x0f) << 8);
+    fat1 = (fat[1] >> 4) | (fat[2] << 4);
+    if(!(bs->bsJump[0] == 0xe9 || (bs->bsJump[0] == 0xeb && bs->bsJump[2] == 0x90))) {
+        snprintf(why, whylen, "bad jump instruction");
+        result = TRIAGE_REPAIRABLE;
+    } else if(bs->bsBootSectSig0 != BOOTSIG0 || bs->bsBootSectSig1 != BOOTSIG1) {
+        snprintf(why, whylen, "no boot sector signature");
+        result = TRIAGE_REPAIRABLE;
+    } else if(media != 0xf0 && media < 0xf8) {
+        snprintf(why, whylen, "unknown media byte %02x", media);
+        result = TRIAGE_REPAIRABLE;
+    } else if(fat0 != (0xf00 | media)) {
+        snprintf(why, whylen, "FAT[0] %03x doesn't match the media byte %02x", fat0, media);
+        result = TRIAGE_REPAIRABLE;
+    } else if(fat1 < (FAT12_MASK & CLUST_EOFS)) {
+        snprintf(why, whylen, "FAT[1] %03x is not an end of chain mark", fat1);
+        result = TRIAGE_REPAIRABLE;
+    }
+    return result;
+}
+
+const char *triage_name(int result) {
+    return result == TRIAGE_VALID ? "valid" : result == TRIAGE_REPAIRABLE ? "repairable" : "junk";
+}
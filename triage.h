@@ -0,0 +1,10 @@
+/* By: Bagus Maulana */
+
+/* prototypes for functions in triage.c */
+
+#define TRIAGE_VALID       0
+#define TRIAGE_JUNK        1  // not a FAT12 image this program can work on
+#define TRIAGE_REPAIRABLE  2  // a FAT12 image with a damaged boot sector or reserved FAT entries
+
+int triage_image(char *imagename, char *why, int whylen);
+const char *triage_name(int result);
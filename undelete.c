@@ -0,0 +1,143 @@
+/* By: Bagus Maulana */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "bootsect.h"
+#include "bpb.h"
+#include "direntry.h"
+#include "fat.h"
+#include "dos.h"
+#include "dos_scandisk.h"
+#include "undelete.h"
+#include "dirwalk.h"
+
+// what replaces the first letter of the name, which DOS overwrote: the first of these
+// that doesn't give a name already in the directory
+#define UNDELETE_CHARS "_0123456789"
+
+int is_free(uint64_t *free_map, uint16_t cluster) {
+    return (free_map[cluster / 64] >> (cluster % 64)) & 1;
+}
+
+void take_cluster(uint64_t *free_map, uint16_t cluster) {
+    free_map[cluster / 64] &= ~((uint64_t) 1 << (cluster % 64));
+}
+
+int next_free(uint64_t *free_map, int cluster, int nclust) {
+    // Returns the first free cluster at or after cluster, or -1. Skips full words at a time.
+    uint64_t word;
+    if(cluster >= nclust)
+        return -1;
+    word = free_map[cluster / 64] & (~(uint64_t) 0 << (cluster % 64));
+    while(!word) {
+        cluster = (cluster / 64 + 1) * 64;
+        if(cluster >= nclust)
+            return -1;
+        word = free_map[cluster / 64];
+    }
+    cluster = (cluster / 64) * 64 + __builtin_ctzll(word);
+    return cluster < nclust ? cluster : -1;
+}
+
+int same_name(struct direntry *de, struct dir_pos *pos, void *arg) {
+    // stops the walk at an entry with the name and extension in arg
+    return memcmp(de->deName, arg, 8) == 0 && memcmp(de->deExtension, (uint8_t *) arg + 8, 3) == 0;
+}
+
+int free_name(struct deleted_entry *e, uint8_t *image_buf, struct bpb33 *bpb) {
+    // Returns the first of UNDELETE_CHARS that makes a name no other entry in the
+    // directory has, or 0 if they all clash
+    uint8_t name[11];
+    struct dir_visitor v = {NULL, same_name, name, 0, NULL};
+    const char *c;
+
+    memcpy(name, e->de->deName, 8);
+    memcpy(name + 8, e->de->deExtension, 3);
+    for(c = UNDELETE_CHARS; *c; c++) {
+        name[0] = *c;
+        if(!for_each_entry(e->dir_cluster, 0, &v, image_buf, bpb))
+            return *c;
+    }
+    return 0;
+}
+
+int undelete_files(struct deleted_list *deleted, uint8_t *image_buf, struct bpb33 *bpb) {
+    // Tries to bring back each deleted file. The clusters a file used are free in the FAT
+    // now, so its chain is rebuilt: the run of clusters from its start cluster if they are
+    // all still free, or else the next free clusters after the start (which is how DOS
+    // would have laid it out). Clusters given to one file are taken out of the free map,
+    // so two deleted files can't both get them. The first letter of the name is lost, and
+    // so are long names (their slots aren't brought back). Returns the number of files
+    // recovered.
+    int nclust = num_clusters(bpb), cluster_size = bpb->bpbBytesPerSec * bpb->bpbSecPerClust;
+    uint64_t *free_map = calloc((nclust + 63) / 64, sizeof(uint64_t));
+    uint16_t *chain = malloc(nclust * sizeof(uint16_t));
+    int i, k, n, c, first, recovered = 0, contiguous;
+    char name[9], extension[4];
+
+    for(c = CLUST_FIRST; c < nclust; c++) {
+        if(get_fat_entry(c, image_buf, bpb) == CLUST_FREE)
+            free_map[c / 64] |= (uint64_t) 1 << (c % 64);
+    }
+
+    for(i = 0; i < deleted->n; i++) {
+        struct direntry *de = deleted->entries[i].de;
+        uint16_t start = getushort(de->deStartCluster);
+        uint32_t size = getulong(de->deFileSize);
+
+        dirent_name(de, name, extension);
+        name[0] = UNDELETE_CHARS[0];
+        n = (size + cluster_size - 1) / cluster_size;
+        if(n == 0 || start < CLUST_FIRST || start >= nclust) {
+            printf("Undelete: %s.%s has no clusters to recover\n", name, extension);
+            continue;
+        }
+        if(!is_free(free_map, start)) {
+            printf("Undelete: %s.%s start cluster %i is in use, not recoverable\n", name, extension, start);
+            continue;
+        }
+
+        contiguous = start + n <= nclust;
+        for(k = 0; k < n && contiguous; k++)
+            contiguous = is_free(free_map, start + k);
+        if(contiguous) {
+            for(k = 0; k < n; k++)
+                chain[k] = start + k;
+        } else {
+            for(k = 0, c = start; k < n && c >= 0; k++, c = next_free(free_map, c + 1, nclust))
+                chain[k] = c;
+            if(k < n) {
+                printf("Undelete: %s.%s needs %i clusters, not enough free after %i\n", name, extension, n, start);
+                continue;
+            }
+        }
+
+        first = free_name(&deleted->entries[i], image_buf, bpb);
+        if(!first) {
+            printf("Undelete: %s.%s would clash with a file already in its directory\n", name, extension);
+            continue;
+        }
+        name[0] = first;
+
+        // link the chain and give the entry its name back
+        for(k = 0; k < n; k++) {
+            take_cluster(free_map, chain[k]);
+            set_fat_entry(chain[k], k == n - 1 ? (FAT12_MASK & CLUST_EOFE) : chain[k + 1], image_buf, bpb);
+        }
+        de->deName[0] = first;
+        recovered++;
+        printf("Undelete: %s.%s %i clusters from %i (%s)%s\n", name, extension, n, start, contiguous ? "contiguous" : "fragmented",
+               deleted->entries[i].long_name ? ", long name not recovered" : "");
+    }
+    if(recovered)
+        mirror_fat(image_buf, bpb);
+    printf("Undelete: %i of %i deleted files recovered\n", recovered, deleted->n);
+
+    free(chain);
+    free(free_map);
+    return recovered;
+}
@@ -0,0 +1,5 @@
+/* By: Bagus Maulana */
+
+/* prototypes for functions in undelete.c */
+
+int undelete_files(struct deleted_list *deleted, uint8_t *image_buf, struct bpb33 *bpb);
@@ -0,0 +1,166 @@
+/* By: Bagus Maulana */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "bootsect.h"
+#include "bpb.h"
+#include "direntry.h"
+#include "fat.h"
+#include "dos.h"
+#include "dos_scandisk.h"
+#include "validate.h"
+
+static const char illegal_chars[] = "\"*+,./:;<=>?[\\]|";
+
+uint32_t max_file_size(struct bpb33 *bpb) {
+    return (num_clusters(bpb) - CLUST_FIRST) * bpb->bpbBytesPerSec * bpb->bpbSecPerClust;
+}
+
+int field_problems(struct direntry *de, uint32_t nclust, uint32_t maxsize) {
+    // Checks everything about an entry that doesn't need the FAT
+    uint8_t *name = de->deName;
+    uint16_t mtime = getushort(de->deMTime), mdate = getushort(de->deMDate), cluster = getushort(de->deStartCluster);
+    uint32_t size = getulong(de->deFileSize);
+    int i, problems = 0, is_dir = (de->deAttributes & ATTR_DIRECTORY) != 0;
+
+    for(i = 0; i < 11; i++) {
+        if((name[i] < 0x20 && !(i == 0 && name[i] == SLOT_E5)) || (name[i] >= 'a' && name[i] <= 'z')
+           || (name[i] < 0x80 && strchr(illegal_chars, name[i])))
+            problems |= DE_BAD_NAME;
+    }
+    if((de->deAttributes & 0xc0) || (de->deAttributes & (ATTR_VOLUME | ATTR_DIRECTORY)) == (ATTR_VOLUME | ATTR_DIRECTORY))
+        problems |= DE_BAD_ATTR;
+    if((size || is_dir) && (cluster < CLUST_FIRST || cluster >= nclust))
+        problems |= DE_BAD_CLUSTER;
+    if(size > maxsize || (is_dir && size))
+        problems |= DE_BAD_SIZE;
+    if((mtime & DT_2SECONDS_MASK) > 29 || ((mtime & DT_MINUTES_MASK) >> DT_MINUTES_SHIFT) > 59
+       || ((mtime & DT_HOURS_MASK) >> DT_HOURS_SHIFT) > 23)
+        problems |= DE_BAD_TIME;
+    if(mdate && ((mdate & DD_DAY_MASK) == 0 || ((mdate & DD_MONTH_MASK) >> DD_MONTH_SHIFT) == 0
+                 || ((mdate & DD_MONTH_MASK) >> DD_MONTH_SHIFT) > 12))
+        problems |= DE_BAD_TIME;
+    return problems;
+}
+
+#ifdef __SSE2__
+int bad_name_sse2(struct direntry *de) {
+    // The same name check as field_problems, on all 11 bytes at once
+    __m128i v = _mm_loadu_si128((__m128i *) de);
+    __m128i bad = _mm_and_si128(_mm_cmplt_epi8(v, _mm_set1_epi8(0x20)), _mm_cmpgt_epi8(v, _mm_set1_epi8(-1)));
+    int i, mask;
+
+    bad = _mm_or_si128(bad, _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('z' + 1))));
+    for(i = 0; illegal_chars[i]; i++)
+        bad = _mm_or_si128(bad, _mm_cmpeq_epi8(v, _mm_set1_epi8(illegal_chars[i])));
+    mask = _mm_movemask_epi8(bad) & 0x7ff;
+    if(de->deName[0] == SLOT_E5)
+        mask &= ~1;
+    return mask != 0;
+}
+
+int bad_fields_sse2(struct direntry *de, int n, uint32_t nclust, uint32_t maxsize) {
+    // The rest of field_problems for four entries at a time, one 32 bit lane each.
+    // Returns a 4 bit mask.
+    uint32_t times[4] = {0}, clusters[4] = {0}, sizes[4] = {0}, attrs[4] = {0};
+    __m128i t, c, s, a, date, month, is_dir, bad, zero = _mm_setzero_si128(), flip = _mm_set1_epi32(0x80000000);
+    int k;
+
+    for(k = 0; k < n && k < 4; k++) {
+        times[k] = getushort(de[k].deMTime) | (getushort(de[k].deMDate) << 16);
+        clusters[k] = getushort(de[k].deStartCluster);
+        sizes[k] = getulong(de[k].deFileSize);
+        attrs[k] = de[k].deAttributes;
+    }
+    t = _mm_loadu_si128((__m128i *) times);
+    c = _mm_loadu_si128((__m128i *) clusters);
+    s = _mm_loadu_si128((__m128i *) sizes);
+    a = _mm_loadu_si128((__m128i *) attrs);
+
+    // time: seconds / 2 <= 29, minutes <= 59, hours <= 23
+    bad = _mm_cmpgt_epi32(_mm_and_si128(t, _mm_set1_epi32(DT_2SECONDS_MASK)), _mm_set1_epi32(29));
+    bad = _mm_or_si128(bad, _mm_cmpgt_epi32(_mm_and_si128(_mm_srli_epi32(t, DT_MINUTES_SHIFT), _mm_set1_epi32(0x3f)), _mm_set1_epi32(59)));
+    bad = _mm_or_si128(bad, _mm_cmpgt_epi32(_mm_and_si128(_mm_srli_epi32(t, DT_HOURS_SHIFT), _mm_set1_epi32(0x1f)), _mm_set1_epi32(23)));
+    // date (if set): day >= 1, 1 <= month <= 12
+    date = _mm_srli_epi32(t, 16);
+    month = _mm_and_si128(_mm_srli_epi32(date, DD_MONTH_SHIFT), _mm_set1_epi32(0xf));
+    bad = _mm_or_si128(bad, _mm_andnot_si128(_mm_cmpeq_epi32(date, zero),
+        _mm_or_si128(_mm_cmpeq_epi32(_mm_and_si128(date, _mm_set1_epi32(DD_DAY_MASK)), zero),
+                     _mm_or_si128(_mm_cmpeq_epi32(month, zero), _mm_cmpgt_epi32(month, _mm_set1_epi32(12))))));
+    // attributes
+    bad = _mm_or_si128(bad, _mm_andnot_si128(_mm_cmpeq_epi32(_mm_and_si128(a, _mm_set1_epi32(0xc0)), zero), _mm_set1_epi32(-1)));
+    bad = _mm_or_si128(bad, _mm_cmpeq_epi32(_mm_and_si128(a, _mm_set1_epi32(ATTR_VOLUME | ATTR_DIRECTORY)), _mm_set1_epi32(ATTR_VOLUME | ATTR_DIRECTORY)));
+    // start cluster, for files with data and directories
+    is_dir = _mm_cmpeq_epi32(_mm_and_si128(a, _mm_set1_epi32(ATTR_DIRECTORY)), _mm_set1_epi32(ATTR_DIRECTORY));
+    bad = _mm_or_si128(bad, _mm_and_si128(_mm_or_si128(_mm_andnot_si128(_mm_cmpeq_epi32(s, zero), _mm_set1_epi32(-1)), is_dir),
+        _mm_or_si128(_mm_cmplt_epi32(c, _mm_set1_epi32(CLUST_FIRST)), _mm_cmpgt_epi32(c, _mm_set1_epi32(nclust - 1)))));
+    // size (unsigned, so compared with the sign bits flipped)
+    bad = _mm_or_si128(bad, _mm_cmpgt_epi32(_mm_xor_si128(s, flip), _mm_xor_si128(_mm_set1_epi32(maxsize), flip)));
+    bad = _mm_or_si128(bad, _mm_andnot_si128(_mm_cmpeq_epi32(s, zero), is_dir));
+    return _mm_movemask_ps(_mm_castsi128_ps(bad));
+}
+#endif
+
+int is_dot_entry(struct direntry *de) {
+    return memcmp(de->deName, ".          ", 11) == 0 || memcmp(de->deName, "..         ", 11) == 0;
+}
+
+uint64_t suspect_entries(struct direntry *des, int n, struct bpb33 *bpb) {
+    // Checks up to 64 directory entries in bulk and returns a mask of the ones that look
+    // wrong, so the walk only has to look closer at those (with entry_problems). Deleted
+    // entries, long name slots, "." and ".." and anything after the end of the directory
+    // are never suspect.
+    uint32_t nclust = num_clusters(bpb), maxsize = max_file_size(bpb);
+    uint64_t live = 0, suspect = 0;
+    int i;
+
+    for(i = 0; i < n && des[i].deName[0] != SLOT_EMPTY; i++) {
+        if(des[i].deName[0] != SLOT_DELETED && des[i].deAttributes != ATTR_WIN95 && !is_dot_entry(&des[i]))
+            live |= (uint64_t) 1 << i;
+    }
+    n = i;
+#ifdef __SSE2__
+    for(i = 0; i < n; i++)
+        suspect |= (uint64_t) bad_name_sse2(&des[i]) << i;
+    for(i = 0; i < n; i += 4)
+        suspect |= (uint64_t) bad_fields_sse2(&des[i], n - i, nclust, maxsize) << i;
+#else
+    for(i = 0; i < n; i++) {
+        if(field_problems(&des[i], nclust, maxsize))
+            suspect |= (uint64_t) 1 << i;
+    }
+#endif
+    return suspect & live;
+}
+
+int entry_problems(struct direntry *de, struct bpb33 *bpb) {
+    // Full check of one entry, saying what is wrong with it (DE_* flags). Whether the
+    // chain is long enough for the size is left to follow_dir, which counts it anyway.
+    return field_problems(de, num_clusters(bpb), max_file_size(bpb));
+}
+
+void print_entry_problems(struct direntry *de, int problems, uint16_t dir_cluster, FILE *out) {
+    char name[9], extension[4];
+    int i;
+
+    dirent_name(de, name, extension);
+    for(i = 0; name[i]; i++) {
+        if((uint8_t) name[i] < 0x20 || (uint8_t) name[i] >= 0x7f)
+            name[i] = '?';
+    }
+    for(i = 0; extension[i]; i++) {
+        if((uint8_t) extension[i] < 0x20 || (uint8_t) extension[i] >= 0x7f)
+            extension[i] = '?';
+    }
+    fprintf(out, "Suspect entry: %s.%s in directory %i:%s%s%s%s%s%s\n", name, extension, dir_cluster,
+           problems & DE_BAD_NAME ? " bad name" : "", problems & DE_BAD_ATTR ? " bad attributes" : "",
+           problems & DE_BAD_CLUSTER ? " bad start cluster" : "", problems & DE_BAD_TIME ? " bad date/time" : "",
+           problems & DE_BAD_SIZE ? " bad size" : "", problems & DE_GARBAGE ? " (ignored)" : "");
+}
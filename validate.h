@@ -0,0 +1,15 @@
+/* By: Bagus Maulana */
+
+/* prototypes for functions in validate.c */
+
+// what entry_problems can find wrong with a direntry
+#define DE_BAD_NAME     0x01  // characters that can't be in an 8.3 name (only reported: other systems write lowercase ones)
+#define DE_BAD_ATTR     0x02  // reserved attribute bits, or a volume label that is also a directory
+#define DE_BAD_CLUSTER  0x04  // start cluster outside the data area
+#define DE_BAD_TIME     0x08  // impossible modification date or time
+#define DE_BAD_SIZE     0x10  // size bigger than the disk, a directory with a size, or a short chain
+#define DE_GARBAGE      (DE_BAD_ATTR | DE_BAD_CLUSTER)  // not a real entry at all
+
+uint64_t suspect_entries(struct direntry *des, int n, struct bpb33 *bpb);
+int entry_problems(struct direntry *de, struct bpb33 *bpb);
+void print_entry_problems(struct direntry *de, int problems, uint16_t dir_cluster, FILE *out);
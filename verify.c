@@ -0,0 +1,175 @@
+/* By: Bagus Maulana */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <sys/types.h>
+
+#include "bootsect.h"
+#include "bpb.h"
+#include "direntry.h"
+#include "fat.h"
+#include "dos.h"
+#include "dos_scandisk.h"
+#include "validate.h"
+#include "fatscan.h"
+#include "verify.h"
+
+void log_fat_entry(struct repair_log *log, uint16_t cluster, uint16_t value) {
+    // Called for each FAT entry a repair writes
+    uint16_t **list = value == CLUST_FREE ? &log->freed : &log->ends;
+    int *n = value == CLUST_FREE ? &log->nfreed : &log->nends;
+    if(*n == 0 || (*n & (*n - 1)) == 0)
+        *list = realloc(*list, (*n ? 2 * *n : 1) * sizeof(uint16_t));
+    (*list)[(*n)++] = cluster;
+}
+
+int problem(const char *format, ...) {
+    va_list ap;
+    va_start(ap, format);
+    printf("Verify: ");
+    vprintf(format, ap);
+    printf("\n");
+    va_end(ap);
+    return 1;
+}
+
+const char *file_name(struct file *f, char *buf, int len) {
+    snprintf(buf, len, "%s%s%s", f->name, f->ext[0] ? "." : "", f->ext);
+    return buf;
+}
+
+int check_chain(struct file *f, int expected, uint8_t *seen, uint8_t *image_buf, struct bpb33 *bpb) {
+    // Follows a chain the repairs touched. It has to stay on the disk, share no cluster
+    // with the other touched chains and be expected clusters long. Returns the problems.
+    int nclust = num_clusters(bpb), n = 0;
+    uint16_t cluster = f->start_cluster;
+    char name[16];
+
+    while(!is_end_of_file(cluster)) {
+        if(cluster < CLUST_FIRST || cluster >= nclust)
+            return problem("%s runs off the disk after %i clusters", file_name(f, name, sizeof(name)), n);
+        if(seen[cluster])
+            return problem("%s shares cluster %i with another repaired chain, or loops", file_name(f, name, sizeof(name)), cluster);
+        seen[cluster] = 1;
+        n++;
+        cluster = get_fat_entry(cluster, image_buf, bpb);
+    }
+    if(n != expected)
+        return problem("%s is %i clusters long, not %i", file_name(f, name, sizeof(name)), n, expected);
+    return 0;
+}
+
+void mark_sector(uint8_t *sectors, uint8_t *p, uint8_t *image_buf, struct bpb33 *bpb) {
+    sectors[(p - image_buf) / bpb->bpbBytesPerSec] = 1;
+}
+
+int verify_repairs(struct repair_log *log, struct file *unref, int unrefctr, struct file *files, int filectr,
+                   struct fat_summary *fs, uint8_t *image_buf, struct bpb33 *bpb) {
+    // Checks again only what the repairs touched, against what the scan already knows:
+    // the root entries made for lost files and the chains they lead to, the ".." entries
+    // of lost directories, the chains that were cut short and the clusters cut off them,
+    // and every entry in the FAT sectors that were written to (so an entry next to a
+    // written one can't have been damaged). Prints each problem it finds, then a summary.
+    // Returns the number of problems.
+    int cluster_size = bpb->bpbBytesPerSec * bpb->bpbSecPerClust, nclust = num_clusters(bpb);
+    int i, problems = 0, chains = 0, ndirs = 0, nfat = 0;
+    uint32_t fat_start = bpb->bpbResSectors, s, c, first, last;
+    uint8_t *seen = calloc(nclust, 1), *written = calloc(nclust, 1), *sectors = calloc(bpb->bpbSectors, 1);
+    struct direntry **cut = calloc(nclust, sizeof(struct direntry *));  // the entry each cut chain was checked for
+    uint16_t value;
+    char name[16];
+
+    for(i = 0; i < unrefctr; i++) {
+        struct file *f = &unref[i];
+        struct direntry *de = log->entries[i];
+
+        file_name(f, name, sizeof(name));
+        if(!de) {
+            problems += problem("%s has no entry, the root directory is full", name);
+            continue;
+        }
+        mark_sector(sectors, (uint8_t *) de, image_buf, bpb);
+        if(getushort(de->deStartCluster) != f->start_cluster || !(de->deAttributes & ATTR_DIRECTORY) != !f->is_dir
+           || (entry_problems(de, bpb) & (DE_GARBAGE | DE_BAD_NAME | DE_BAD_SIZE)))
+            problems += problem("%s has a damaged entry in the root directory", name);
+        chains++;
+        problems += check_chain(f, f->clusters, seen, image_buf, bpb);
+        if(f->is_dir) {
+            struct direntry *dots = (struct direntry *) cluster_to_addr(f->start_cluster, image_buf, bpb);
+            mark_sector(sectors, (uint8_t *) dots, image_buf, bpb);
+            if(getushort(dots[0].deStartCluster) != f->start_cluster || getushort(dots[1].deStartCluster) != MSDOSFSROOT)
+                problems += problem("%s doesn't point back at itself and the root", name);
+        } else if(f->size / cluster_size + 1 < (uint32_t) f->clusters) {
+            problems += problem("%s is still too long for its size", name);
+        }
+    }
+    for(i = 0; i < filectr; i++) {
+        // a directory two entries lead to lists its files twice, but each chain is cut once
+        if(!files[i].oversized || (files[i].start_cluster < nclust && cut[files[i].start_cluster] == files[i].de))
+            continue;
+        if(files[i].start_cluster < nclust)
+            cut[files[i].start_cluster] = files[i].de;
+        chains++;
+        problems += check_chain(&files[i], files[i].size / cluster_size + 1, seen, image_buf, bpb);
+    }
+
+    for(i = 0; i < log->nends; i++) {
+        written[log->ends[i]] = 1;
+        if(!is_end_of_file(get_fat_entry(log->ends[i], image_buf, bpb)))
+            problems += problem("cluster %i should end a chain", log->ends[i]);
+    }
+    for(i = 0; i < log->nfreed; i++) {
+        c = log->freed[i];
+        written[c] = 1;
+        if(get_fat_entry(c, image_buf, bpb) != CLUST_FREE)
+            problems += problem("cluster %i was cut off a chain but isn't free", c);
+        else if(seen[c])
+            problems += problem("cluster %i was freed but is still in a repaired chain", c);
+        else if(fs->indegree[c] > 1)
+            problems += problem("cluster %i was freed but another chain still leads to it", c);
+    }
+
+    // the rest of each FAT sector written to must be as the scan found it
+    for(i = 0; i < log->nends + log->nfreed; i++) {
+        c = i < log->nends ? log->ends[i] : log->freed[i - log->nends];
+        sectors[fat_start + c * 3 / 2 / bpb->bpbBytesPerSec] = 1;
+        sectors[fat_start + (c * 3 / 2 + 1) / bpb->bpbBytesPerSec] = 1;
+    }
+    for(s = fat_start; s < fat_start + bpb->bpbFATsecs; s++) {
+        if(!sectors[s])
+            continue;
+        nfat++;
+        first = (s - fat_start) * bpb->bpbBytesPerSec * 2 / 3;
+        last = ((s - fat_start + 1) * bpb->bpbBytesPerSec * 2 + 2) / 3;
+        for(c = first > CLUST_FIRST ? first : CLUST_FIRST; c < last && c < (uint32_t) nclust; c++) {
+            if(written[c])
+                continue;
+            value = get_fat_entry(c, image_buf, bpb);
+            if((value == (FAT12_MASK & CLUST_BAD)) != cluster_marked_bad(fs, c)
+               || (value != CLUST_FREE && value != (FAT12_MASK & CLUST_BAD)) != cluster_allocated(fs, c))
+                problems += problem("the FAT entry for cluster %i changed next to a repaired one", c);
+        }
+    }
+    for(s = fat_start + bpb->bpbFATs * bpb->bpbFATsecs; s < bpb->bpbSectors; s++)
+        ndirs += sectors[s];
+
+    if(problems)
+        printf("Verify: FAILED, the repairs left %i problem%s\n", problems, problems == 1 ? "" : "s");
+    else
+        printf("Verify: %i repaired chain%s, %i directory sector%s and %i FAT sector%s consistent\n",
+               chains, chains == 1 ? "" : "s", ndirs, ndirs == 1 ? "" : "s", nfat, nfat == 1 ? "" : "s");
+    free(seen);
+    free(cut);
+    free(written);
+    free(sectors);
+    return problems;
+}
+
+void free_repair_log(struct repair_log *log) {
+    free(log->freed);
+    free(log->ends);
+    free(log->entries);
+}
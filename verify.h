@@ -0,0 +1,17 @@
+/* By: Bagus Maulana */
+
+/* prototypes for functions in verify.c */
+
+// what the repairs wrote, so that only that has to be checked again
+struct repair_log {
+    uint16_t *freed;            // clusters a truncation freed
+    int nfreed;
+    uint16_t *ends;             // clusters a truncation made the end of a chain
+    int nends;
+    struct direntry **entries;  // per lost file: the root entry made for it, or NULL
+};
+
+void log_fat_entry(struct repair_log *log, uint16_t cluster, uint16_t value);
+int verify_repairs(struct repair_log *log, struct file *unref, int unrefctr, struct file *files, int filectr,
+                   struct fat_summary *fs, uint8_t *image_buf, struct bpb33 *bpb);
+void free_repair_log(struct repair_log *log);
@@ -0,0 +1,334 @@
+/* By: Bagus Maulana */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "bootsect.h"
+#include "bpb.h"
+#include "direntry.h"
+#include "fat.h"
+#include "dos.h"
+#include "dos_scandisk.h"
+#include "validate.h"
+#include "memcap.h"
+#include "cancel.h"
+#include "walk.h"
+#include "dirwalk.h"
+
+// What walking one directory found, kept until the directories are merged back into
+// the order follow_dir would have seen them in
+struct walk_item {
+    int is_dir;      // a subdirectory, or a file
+    int index;       // the subdirectory's start cluster, or the file's index in files
+    long text_end;   // how much of the directory's messages come before this item
+};
+
+struct dir_result {
+    struct file *files;
+    int nfiles;
+    struct walk_item *items;
+    int nitems;
+    char *text;      // the messages the walk printed, in order
+    size_t textlen;
+};
+
+// A thread's deque of directories to walk. The owner takes from the bottom (the
+// directory it found last), idle threads steal from the top.
+struct deque {
+    pthread_mutex_t lock;
+    uint16_t *tasks;
+    int top, bottom, cap;
+};
+
+struct walk {
+    int nthreads;
+    uint32_t nclust;
+    struct deque *deques;
+    int pending;                  // directories queued or being walked
+    uint64_t *visited;            // clusters used by the tree, set atomically
+    uint64_t *claimed;            // directories a thread has taken on, set atomically
+    struct dir_result **results;  // by start cluster
+    uint8_t *on_stack;            // directories being merged, so a loop is only merged once
+    uint8_t *image_buf;
+    struct bpb33 *bpb;
+};
+
+struct walk_thread {
+    struct walk *w;
+    int self;
+};
+
+int test_and_set(uint64_t *bits, uint32_t n) {
+    // Sets bit n, returning whether it was already set
+    uint64_t bit = (uint64_t) 1 << (n % 64);
+    return (__atomic_fetch_or(&bits[n / 64], bit, __ATOMIC_ACQ_REL) & bit) != 0;
+}
+
+void push_task(struct walk *w, int self, uint16_t cluster) {
+    struct deque *q = &w->deques[self];
+    __atomic_add_fetch(&w->pending, 1, __ATOMIC_ACQ_REL);
+    pthread_mutex_lock(&q->lock);
+    if(q->bottom == q->cap) {
+        // slide the live part down, or make room
+        if(q->top > 0) {
+            memmove(q->tasks, q->tasks + q->top, (q->bottom - q->top) * sizeof(uint16_t));
+            q->bottom -= q->top;
+            q->top = 0;
+        }
+        if(q->bottom == q->cap) {
+            q->cap = q->cap ? 2 * q->cap : 64;
+            q->tasks = realloc(q->tasks, q->cap * sizeof(uint16_t));
+        }
+    }
+    q->tasks[q->bottom++] = cluster;
+    pthread_mutex_unlock(&q->lock);
+}
+
+int take_task(struct walk *w, int self, uint16_t *cluster) {
+    // Takes the newest task from this thread's deque, or else steals the oldest one from
+    // another thread's. Returns 0 if every deque is empty.
+    struct deque *q = &w->deques[self];
+    int t, found = 0;
+
+    pthread_mutex_lock(&q->lock);
+    if(q->bottom > q->top) {
+        *cluster = q->tasks[--q->bottom];
+        found = 1;
+    }
+    pthread_mutex_unlock(&q->lock);
+    for(t = 1; t < w->nthreads && !found; t++) {
+        q = &w->deques[(self + t) % w->nthreads];
+        pthread_mutex_lock(&q->lock);
+        if(q->bottom > q->top) {
+            *cluster = q->tasks[q->top++];
+            found = 1;
+        }
+        pthread_mutex_unlock(&q->lock);
+    }
+    return found;
+}
+
+int walk_chain(struct walk *w, uint16_t cluster) {
+    // follow_non_dir on the shared bitset; a looped chain stops after every cluster
+    int clusters = 0;
+    while(!is_end_of_file(cluster) && cluster >= CLUST_FIRST && cluster < w->nclust && clusters < (int) w->nclust && !scan_step()) {
+        test_and_set(w->visited, cluster);
+        cluster = get_fat_entry(cluster, w->image_buf, w->bpb);
+        clusters++;
+    }
+    return clusters;
+}
+
+void add_item(struct dir_result *r, int is_dir, int index, FILE *text) {
+    if(r->nitems == 0 || (r->nitems & (r->nitems - 1)) == 0)
+        r->items = realloc(r->items, (r->nitems ? 2 * r->nitems : 1) * sizeof(struct walk_item));
+    r->items[r->nitems].is_dir = is_dir;
+    r->items[r->nitems].index = index;
+    r->items[r->nitems].text_end = ftell(text);
+    r->nitems++;
+}
+
+// what walk_dir's callbacks need
+struct walk_dir {
+    struct walk *w;
+    int self;
+    struct dir_result *r;
+    FILE *text;
+};
+
+int walk_dir_cluster(uint16_t cluster, void *arg) {
+    struct walk_dir *wd = arg;
+    if(scan_step())
+        return 1;
+    if(cluster != MSDOSFSROOT)
+        test_and_set(wd->w->visited, cluster);
+    return 0;
+}
+
+int walk_dir_entry(struct direntry *dirent, struct dir_pos *pos, void *arg) {
+    struct walk_dir *wd = arg;
+    struct walk *w = wd->w;
+    struct dir_result *r = wd->r;
+    struct bpb33 *bpb = w->bpb;
+    int cluster_size = bpb->bpbBytesPerSec * bpb->bpbSecPerClust;
+    char name[9], extension[4];
+    uint32_t size;
+    uint16_t file_cluster;
+
+    if(scan_stopped())
+        return 1;  // the chains from here on would look short
+    int problems = pos->suspect ? entry_problems(dirent, bpb) : 0;
+    if(problems & DE_GARBAGE) {
+        print_entry_problems(dirent, problems, pos->dir_cluster, wd->text);
+        return 0;
+    }
+
+    if((dirent->deAttributes & ATTR_DIRECTORY) != 0) {
+        file_cluster = getushort(dirent->deStartCluster);
+        if(problems)
+            print_entry_problems(dirent, problems, pos->dir_cluster, wd->text);
+        if(file_cluster < CLUST_FIRST || file_cluster >= w->nclust)
+            return 0;
+        add_item(r, 1, file_cluster, wd->text);
+        if(!test_and_set(w->claimed, file_cluster))
+            push_task(w, wd->self, file_cluster);  // another entry may lead to it as well
+    } else if((dirent->deAttributes & ATTR_VOLUME) == 0) {
+        dirent_name(dirent, name, extension);
+        size = getulong(dirent->deFileSize);
+        file_cluster = getushort(dirent->deStartCluster);
+        int clusters = walk_chain(w, file_cluster);
+        if(scan_stopped())
+            return 1;
+        if((uint32_t) clusters < (size + cluster_size - 1) / cluster_size)
+            problems |= DE_BAD_SIZE;
+        if(problems)
+            print_entry_problems(dirent, problems, pos->dir_cluster, wd->text);
+
+        if(r->nfiles == 0 || (r->nfiles & (r->nfiles - 1)) == 0)
+            r->files = realloc(r->files, (r->nfiles ? 2 * r->nfiles : 1) * sizeof(struct file));
+        memset(&r->files[r->nfiles], 0, sizeof(struct file));
+        strcpy(r->files[r->nfiles].name, name);
+        strcpy(r->files[r->nfiles].ext, extension);
+        r->files[r->nfiles].size = size;
+        r->files[r->nfiles].start_cluster = file_cluster;
+        r->files[r->nfiles].clusters = clusters;
+        r->files[r->nfiles].de = dirent;
+        r->files[r->nfiles].lfn = pos->lfn;
+        add_item(r, 0, r->nfiles, wd->text);
+        r->nfiles++;
+    }
+    return 0;
+}
+
+void walk_dir(struct walk *w, int self, uint16_t cluster) {
+    // The body of follow_dir for one directory, except that subdirectories become tasks
+    // and messages go to the directory's own buffer
+    struct dir_result *r = calloc(1, sizeof(struct dir_result));
+    FILE *text = open_memstream(&r->text, &r->textlen);
+    struct walk_dir wd = {w, self, r, text};
+    struct dir_visitor v = {walk_dir_cluster, walk_dir_entry, &wd, DIR_VOLUME | DIR_CHECK, text};
+
+    w->results[cluster] = r;
+    scan_dir();
+    for_each_entry(cluster, 0, &v, w->image_buf, w->bpb);
+    fclose(text);
+}
+
+void *walk_thread(void *arg) {
+    struct walk_thread *wt = arg;
+    struct walk *w = wt->w;
+    uint16_t cluster;
+
+    while(__atomic_load_n(&w->pending, __ATOMIC_ACQUIRE) > 0) {
+        if(take_task(w, wt->self, &cluster)) {
+            walk_dir(w, wt->self, cluster);
+            __atomic_sub_fetch(&w->pending, 1, __ATOMIC_ACQ_REL);
+        } else {
+            sched_yield();  // the others are still walking, and may find more directories
+        }
+    }
+    return NULL;
+}
+
+void merge_dir(struct walk *w, uint16_t cluster, struct file **files, int *filectr) {
+    // Puts a directory's messages and files out in entry order, merging each
+    // subdirectory in where its entry is, as the recursion in follow_dir would
+    struct dir_result *r = w->results[cluster];
+    long printed = 0;
+    int k;
+
+    if(!r || w->on_stack[cluster])
+        return;
+    w->on_stack[cluster] = 1;
+    for(k = 0; k < r->nitems; k++) {
+        fwrite(r->text + printed, 1, r->items[k].text_end - printed, stdout);
+        printed = r->items[k].text_end;
+        if(r->items[k].is_dir)
+            merge_dir(w, r->items[k].index, files, filectr);
+        else
+            *add_file(files, filectr) = r->files[r->items[k].index];
+    }
+    fwrite(r->text + printed, 1, r->textlen - printed, stdout);
+    w->on_stack[cluster] = 0;
+}
+
+void walk_tree(int nthreads, int *visited, struct file **files, int *filectr, uint8_t *image_buf, struct bpb33 *bpb) {
+    // follow_dir(0, ...) spread over nthreads threads. Each directory found is a task on
+    // the deque of the thread that found it, and idle threads steal tasks. Clusters are
+    // marked in a shared bitset, and the files and messages of each directory are kept
+    // apart and merged at the end, so the result is the same as follow_dir's. A
+    // directory that more than one entry leads to is walked once.
+    struct walk w;
+    struct walk_thread *wts;
+    pthread_t *threads;
+    int *started;
+    uint32_t c;
+    int t;
+
+    if(nthreads < 1)
+        nthreads = 1;
+    memset(&w, 0, sizeof(w));
+    w.nthreads = nthreads;
+    w.nclust = num_clusters(bpb);
+    w.deques = calloc(nthreads, sizeof(struct deque));
+    w.visited = capped_calloc((w.nclust + 63) / 64, sizeof(uint64_t));
+    w.claimed = capped_calloc((w.nclust + 63) / 64, sizeof(uint64_t));
+    w.results = calloc(w.nclust, sizeof(struct dir_result *));
+    w.on_stack = calloc(w.nclust, 1);
+    w.image_buf = image_buf;
+    w.bpb = bpb;
+    wts = calloc(nthreads, sizeof(struct walk_thread));
+    threads = malloc(nthreads * sizeof(pthread_t));
+    started = calloc(nthreads, sizeof(int));
+    for(t = 0; t < nthreads; t++)
+        pthread_mutex_init(&w.deques[t].lock, NULL);
+
+    test_and_set(w.claimed, MSDOSFSROOT);
+    push_task(&w, 0, MSDOSFSROOT);
+    for(t = 0; t < nthreads; t++) {
+        wts[t].w = &w;
+        wts[t].self = t;
+        started[t] = pthread_create(&threads[t], NULL, walk_thread, &wts[t]) == 0;
+        if(!started[t])
+            walk_thread(&wts[t]);
+    }
+    for(t = 0; t < nthreads; t++) {
+        if(started[t])
+            pthread_join(threads[t], NULL);
+    }
+
+    merge_dir(&w, MSDOSFSROOT, files, filectr);
+    fflush(stdout);
+    visited[MSDOSFSROOT] = 1;
+    for(c = CLUST_FIRST; c < w.nclust; c++) {
+        if((w.visited[c / 64] >> (c % 64)) & 1)
+            visited[c] = 1;
+    }
+
+    for(c = 0; c < w.nclust; c++) {
+        if(w.results[c]) {
+            free(w.results[c]->files);
+            free(w.results[c]->items);
+            free(w.results[c]->text);
+            free(w.results[c]);
+        }
+    }
+    for(t = 0; t < nthreads; t++) {
+        pthread_mutex_destroy(&w.deques[t].lock);
+        free(w.deques[t].tasks);
+    }
+    free(started);
+    free(threads);
+    free(wts);
+    free(w.on_stack);
+    free(w.results);
+    capped_free(w.claimed);
+    capped_free(w.visited);
+    free(w.deques);
+}
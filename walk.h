@@ -0,0 +1,5 @@
+/* By: Bagus Maulana */
+
+/* prototypes for functions in walk.c */
+
+void walk_tree(int nthreads, int *visited, struct file **files, int *filectr, uint8_t *image_buf, struct bpb33 *bpb);